@@ -0,0 +1,101 @@
+// Micro-benchmark of output encoding: encode time and size for each output
+// format and PNG compression level, against OpenCV's level-9 PNG (what
+// saveImage used to write). Needs OpenCV and zlib only.
+//
+// Usage: encode-bench [runs]
+
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/png_writer.hpp"
+#include "../src/qoi_writer.hpp"
+
+using namespace cv;
+using namespace std;
+
+template <typename F>
+double timeMs(int runs, F fn) {
+    fn();  // warm caches and lazy allocations
+    int64 start = getTickCount();
+    for (int i = 0; i < runs; i++) {
+        fn();
+    }
+    return (getTickCount() - start) * 1000.0 / getTickFrequency() / runs;
+}
+
+// A cut-out-like BGRA image: smooth photo-like colour, an opaque subject,
+// transparent background and a soft edge
+Mat syntheticCutout(Size size, RNG& rng) {
+    Mat image(size, CV_8UC3);
+    rng.fill(image, RNG::UNIFORM, 0, 256);
+    GaussianBlur(image, image, Size(0, 0), 4.0);
+
+    Mat alpha = Mat::zeros(size, CV_8UC1);
+    ellipse(alpha, Point(size.width / 2, size.height / 2), Size(size.width / 3, size.height * 2 / 5),
+            0, 0, 360, Scalar(255), FILLED);
+    GaussianBlur(alpha, alpha, Size(0, 0), 2.0);
+
+    vector<Mat> channels;
+    split(image, channels);
+    channels.push_back(alpha);
+    Mat bgra;
+    merge(channels, bgra);
+    return bgra;
+}
+
+size_t encodePng(const Mat& bgra, int level, bool parallel) {
+    ostringstream out;
+    PngStreamWriter writer(out, bgra.cols, bgra.rows, 4, level);
+    if (parallel) {
+        writer.writeImage(bgra);
+    } else {
+        writer.writeRows(bgra);
+    }
+    writer.finish();
+    return out.str().size();
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? stoi(argv[1]) : 5;
+    const Size sizes[] = {Size(1280, 960), Size(4000, 3000)};
+    RNG rng(12345);
+
+    printf("%-10s  %-22s  %10s  %12s\n", "size", "format", "encode(ms)", "bytes");
+    for (const Size& size : sizes) {
+        Mat bgra = syntheticCutout(size, rng);
+        string label = to_string(size.width) + "x" + to_string(size.height);
+        auto report = [&](const string& format, double ms, size_t bytes) {
+            printf("%-10s  %-22s  %10.2f  %12zu\n", label.c_str(), format.c_str(), ms, bytes);
+        };
+
+        vector<uchar> buffer;
+        double ms = timeMs(runs, [&] { imencode(".png", bgra, buffer, vector<int>{IMWRITE_PNG_COMPRESSION, 9}); });
+        report("png-9 (opencv, before)", ms, buffer.size());
+
+        for (int level : {1, 6, 9}) {
+            size_t bytes = 0;
+            ms = timeMs(runs, [&] { bytes = encodePng(bgra, level, false); });
+            report("png-" + to_string(level) + " stream", ms, bytes);
+            ms = timeMs(runs, [&] { bytes = encodePng(bgra, level, true); });
+            report("png-" + to_string(level) + " parallel", ms, bytes);
+        }
+
+        bool webp = true;
+        ms = timeMs(runs, [&] { webp = imencode(".webp", bgra, buffer, vector<int>{IMWRITE_WEBP_QUALITY, 101}); });
+        if (webp) {
+            report("webp lossless", ms, buffer.size());
+        } else {
+            report("webp (unavailable)", 0, 0);
+        }
+
+        ms = timeMs(runs, [&] { buffer = encodeQoi(bgra); });
+        report("qoi", ms, buffer.size());
+
+        report("bgra raw", 0, bgra.total() * 4);
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+# ML inference throughput at different batch sizes.
+#
+# Runs bg-remover in --batch mode over a directory of images once per batch
+# size and prints images/second. The model needs a dynamic batch dimension
+# for batch sizes above 1 to take effect.
+#
+# Usage: bench/ml-throughput.sh <model.onnx> <image-dir> [batch sizes...]
+# Env:   BIN (default ./bg-remover), INTRA_THREADS (default 0 = all cores),
+#        MODEL_NORM (default raw)
+
+set -euo pipefail
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <model.onnx> <image-dir> [batch sizes...]" >&2
+    exit 1
+fi
+
+MODEL="$1"
+IMAGES="$2"
+shift 2
+SIZES="${*:-1 2 4 8 16}"
+BIN="${BIN:-./bg-remover}"
+INTRA_THREADS="${INTRA_THREADS:-0}"
+MODEL_NORM="${MODEL_NORM:-raw}"
+
+OUT_DIR=$(mktemp -d)
+trap 'rm -rf "$OUT_DIR"' EXIT
+
+printf "%-8s %-14s %s\n" "batch" "images/s" "result"
+for size in $SIZES; do
+    summary=$("$BIN" --batch "$IMAGES" -o "$OUT_DIR" --model "$MODEL" --model-norm "$MODEL_NORM" \
+        --ml-batch "$size" --intra-threads "$INTRA_THREADS" | grep "^Batch complete")
+    rate=$(echo "$summary" | sed -E 's/.*\(([0-9.e+]+) images\/s\).*/\1/')
+    result=$(echo "$summary" | sed -E 's/^Batch complete: (.*) in [0-9.e+]+s .*/\1/')
+    printf "%-8s %-14s %s\n" "$size" "$rate" "$result"
+done
@@ -0,0 +1,441 @@
+// End-to-end benchmark of the bg-remover binary across presets, edge modes
+// and (when a model is given) ML mode. Generates deterministic synthetic
+// scenes with a known subject at several resolutions, optionally adds a local
+// corpus, runs each configuration as its own --batch process with
+// --metrics-json, and reports throughput, p50/p99 latency, peak RSS and mask
+// agreement. Runs offline and CPU-only.
+//
+// Agreement is IoU of the thresholded alpha and mean absolute alpha error
+// against a reference: the ground truth for synthetic scenes, and the
+// `quality` preset's output for corpus images (or --reference-dir masks, e.g.
+// saved from a previous release).
+//
+// The default sizes run up to 12MP (4000x3000) and 24MP (6000x4000), where
+// the multires preset's coarse-to-fine GrabCut pays off. Scenes of 12MP and
+// more use at most 2 images each to keep a full run practical. After each
+// set, a line compares multires with balanced (also saved in the JSON as
+// the multires result's speedup_vs_balanced).
+//
+// Usage: pipeline-bench [--bin ./bg-remover] [--sizes 640x480,1920x1080]
+//                       [--images 5] [--corpus dir] [--reference-dir dir]
+//                       [--model file.onnx] [--model-norm raw]
+//                       [--json bench-results.json] [--keep]
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace std;
+
+// One way of running the binary
+struct BenchConfig {
+    string name;
+    vector<string> args;
+};
+
+// A directory of inputs processed as one batch, with optional ground truth
+struct ImageSet {
+    string name;
+    string dir;
+    vector<string> files;   // File names inside dir
+    vector<Mat> truth;      // Ground-truth masks, empty for corpus images
+};
+
+struct BenchResult {
+    string config;
+    string set;
+    int images = 0;
+    int failed = 0;
+    double seconds = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double peakRssMB = 0;
+    double speedup = 0;      // multires only: balanced p50 / multires p50 on the same set
+    double iou = -1;        // -1 = no reference
+    double alphaError = -1;
+};
+
+// Deterministic synthetic scene: a textured subject built from a few
+// ellipses on a textured gradient background, with a slightly soft boundary.
+// `truth` receives the subject mask.
+void makeSyntheticImage(Size size, int seed, Mat& image, Mat& truth) {
+    RNG rng(seed);
+
+    Vec3d top(rng.uniform(60, 200), rng.uniform(60, 200), rng.uniform(60, 200));
+    Vec3d bottom(rng.uniform(60, 200), rng.uniform(60, 200), rng.uniform(60, 200));
+    Mat background(size, CV_8UC3);
+    for (int y = 0; y < size.height; y++) {
+        double t = static_cast<double>(y) / max(1, size.height - 1);
+        Vec3d c = top * (1 - t) + bottom * t;
+        background.row(y).setTo(Scalar(c[0], c[1], c[2]));
+    }
+
+    // Subject colour: each channel at the extreme away from the background
+    Scalar subject;
+    for (int c = 0; c < 3; c++) {
+        subject[c] = (top[c] + bottom[c]) / 2 < 128 ? 230 : 25;
+    }
+    Mat foreground(size, CV_8UC3, subject);
+
+    // Low-frequency texture on both layers, scaled up from a small noise field
+    Size noiseSize(max(1, size.width / 16), max(1, size.height / 16));
+    Mat noise(noiseSize, CV_16SC3), texture;
+    rng.fill(noise, RNG::NORMAL, 0, 18);
+    resize(noise, texture, size, 0, 0, INTER_LINEAR);
+    add(background, texture, background, noArray(), CV_8UC3);
+    rng.fill(noise, RNG::NORMAL, 0, 18);
+    resize(noise, texture, size, 0, 0, INTER_LINEAR);
+    add(foreground, texture, foreground, noArray(), CV_8UC3);
+
+    // Subject: overlapping ellipses kept well inside GrabCut's default inset
+    truth = Mat::zeros(size, CV_8UC1);
+    Point center(size.width / 2, size.height / 2);
+    int unit = min(size.width, size.height);
+    for (int i = 0; i < 3; i++) {
+        Point offset(rng.uniform(-unit / 8, unit / 8 + 1), rng.uniform(-unit / 8, unit / 8 + 1));
+        Size axes(rng.uniform(unit / 8, unit / 4), rng.uniform(unit / 8, unit / 4));
+        ellipse(truth, center + offset, axes, rng.uniform(0, 180), 0, 360, Scalar(255), FILLED, LINE_AA);
+    }
+    threshold(truth, truth, 127, 255, THRESH_BINARY);
+
+    image = background.clone();
+    foreground.copyTo(image, truth);
+    GaussianBlur(image, image, Size(0, 0), 0.8);
+}
+
+// Parse "640x480,1920x1080"
+vector<Size> parseSizes(const string& value) {
+    vector<Size> sizes;
+    stringstream list(value);
+    string item;
+    while (getline(list, item, ',')) {
+        int w = 0, h = 0;
+        if (sscanf(item.c_str(), "%dx%d", &w, &h) != 2 || w < 64 || h < 64) {
+            throw invalid_argument("Invalid size: " + item);
+        }
+        sizes.push_back(Size(w, h));
+    }
+    return sizes;
+}
+
+// Run a command with stdout discarded. Returns its exit status.
+int runCommand(const vector<string>& args) {
+    pid_t pid = fork();
+    if (pid < 0) throw runtime_error("fork failed");
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        vector<char*> argv;
+        for (const string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Find `"key":<number>` in a JSON line written by --metrics-json
+bool jsonNumber(const string& line, const string& key, size_t from, double& value) {
+    size_t pos = line.find("\"" + key + "\":", from);
+    if (pos == string::npos) return false;
+    value = atof(line.c_str() + pos + key.size() + 3);
+    return true;
+}
+
+// Per-image latency: the sum of its stage wall times
+double stageWallMs(const string& line) {
+    double total = 0, value;
+    size_t pos = line.find("\"stages\":");
+    while (pos != string::npos && jsonNumber(line, "wall_ms", pos, value)) {
+        total += value;
+        pos = line.find("\"wall_ms\":", pos) + 1;
+    }
+    return total;
+}
+
+// Nearest-rank percentile
+double percentile(vector<double> values, double p) {
+    if (values.empty()) return 0;
+    sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(ceil(p / 100.0 * values.size()));
+    return values[min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// Accumulate IoU and mean absolute alpha error of `alpha` against `reference`
+void compareMasks(const Mat& alpha, const Mat& reference, double& iouSum, double& errorSum) {
+    Mat a = alpha > 127, b = reference > 127;
+    double unionCount = countNonZero(a | b);
+    iouSum += unionCount > 0 ? countNonZero(a & b) / unionCount : 1.0;
+    Mat diff;
+    absdiff(alpha, reference, diff);
+    errorSum += mean(diff)[0] / 255.0;
+}
+
+// Alpha channel of a bg-remover output, or an empty Mat
+Mat readAlpha(const string& path) {
+    Mat image = imread(path, IMREAD_UNCHANGED);
+    if (image.empty()) return Mat();
+    if (image.channels() == 1) return image;
+    Mat alpha;
+    extractChannel(image, alpha, image.channels() - 1);
+    return alpha;
+}
+
+// Same filter as the binary's directory batches, so outputs line up with inputs
+bool hasImageExtension(const string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == string::npos) return false;
+    string ext = path.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp" ||
+           ext == "tif" || ext == "tiff" || ext == "webp";
+}
+
+string stem(const string& file) {
+    size_t dot = file.find_last_of('.');
+    return dot == string::npos ? file : file.substr(0, dot);
+}
+
+// Run one configuration over one image set
+BenchResult runConfig(const string& bin, const BenchConfig& config, const ImageSet& set,
+                      const string& workDir, const vector<Mat>& reference) {
+    string outDir = workDir + "/out-" + config.name + "-" + set.name;
+    string metricsPath = outDir + ".jsonl";
+    utils::fs::createDirectories(outDir);
+    remove(metricsPath.c_str());  // --metrics-json appends
+
+    vector<string> args = {bin, "--batch", set.dir, "-o", outDir, "--metrics-json", metricsPath};
+    args.insert(args.end(), config.args.begin(), config.args.end());
+
+    int64 start = getTickCount();
+    runCommand(args);
+    BenchResult result;
+    result.seconds = (getTickCount() - start) / getTickFrequency();
+    result.config = config.name;
+    result.set = set.name;
+
+    // Per-image lines have an "input" field, the closing line has "batch"
+    vector<double> latencies;
+    ifstream metrics(metricsPath);
+    string line;
+    while (getline(metrics, line)) {
+        double value;
+        if (line.find("\"batch\":") != string::npos) {
+            if (jsonNumber(line, "peak_rss_bytes", 0, value)) result.peakRssMB = value / (1024 * 1024);
+        } else if (line.find("\"status\":\"ok\"") != string::npos) {
+            latencies.push_back(stageWallMs(line));
+        }
+    }
+    result.images = static_cast<int>(set.files.size());
+    result.failed = result.images - static_cast<int>(latencies.size());
+    result.p50 = percentile(latencies, 50);
+    result.p99 = percentile(latencies, 99);
+
+    const vector<Mat>& truth = set.truth.empty() ? reference : set.truth;
+    if (!truth.empty()) {
+        double iouSum = 0, errorSum = 0;
+        int compared = 0;
+        for (size_t i = 0; i < set.files.size(); i++) {
+            Mat alpha = readAlpha(outDir + "/" + stem(set.files[i]) + ".png");
+            if (alpha.empty() || truth[i].empty() || alpha.size() != truth[i].size()) continue;
+            compareMasks(alpha, truth[i], iouSum, errorSum);
+            compared++;
+        }
+        if (compared > 0) {
+            result.iou = iouSum / compared;
+            result.alphaError = errorSum / compared;
+        }
+    }
+    return result;
+}
+
+// Alpha masks of one configuration's outputs, used as the corpus reference
+vector<Mat> loadOutputs(const string& dir, const ImageSet& set) {
+    vector<Mat> masks;
+    for (const string& file : set.files) {
+        masks.push_back(readAlpha(dir + "/" + stem(file) + ".png"));
+    }
+    return masks;
+}
+
+void writeJson(const string& path, const vector<BenchResult>& results) {
+    ofstream out(path);
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "  {\"config\":\"" << r.config << "\",\"set\":\"" << r.set << "\",\"images\":" << r.images
+            << ",\"failed\":" << r.failed << ",\"seconds\":" << r.seconds
+            << ",\"images_per_second\":" << (r.seconds > 0 ? r.images / r.seconds : 0)
+            << ",\"p50_ms\":" << r.p50 << ",\"p99_ms\":" << r.p99 << ",\"peak_rss_mb\":" << r.peakRssMB;
+        if (r.iou >= 0) out << ",\"iou\":" << r.iou << ",\"alpha_error\":" << r.alphaError;
+        if (r.speedup > 0) out << ",\"speedup_vs_balanced\":" << r.speedup;
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Coarse-to-fine GrabCut (multires) against full-resolution GrabCut
+// (balanced) on one set: per-image p50 latency, since batch wall time
+// includes process start-up. Recorded on the multires result.
+void printSpeedup(vector<BenchResult>& results, const string& set) {
+    BenchResult* balanced = nullptr;
+    BenchResult* multires = nullptr;
+    for (BenchResult& r : results) {
+        if (r.set != set) continue;
+        if (r.config == "balanced") balanced = &r;
+        if (r.config == "multires") multires = &r;
+    }
+    if (!balanced || !multires || balanced->p50 <= 0 || multires->p50 <= 0) return;
+
+    multires->speedup = balanced->p50 / multires->p50;
+    printf("  multires vs balanced on %s: p50 %.1f ms vs %.1f ms, %.2fx faster", set.c_str(),
+           multires->p50, balanced->p50, multires->speedup);
+    if (multires->iou >= 0 && balanced->iou >= 0) printf(", iou %.4f vs %.4f", multires->iou, balanced->iou);
+    printf("\n");
+    fflush(stdout);
+}
+
+// Scenes this large get fewer images; GrabCut at full resolution takes seconds each
+const int kLargeScenePixels = 12000000;
+
+int main(int argc, char** argv) {
+    string bin = "./bg-remover";
+    string corpus, referenceDir, model, modelNorm = "raw", jsonPath = "bench-results.json";
+    vector<Size> sizes = {Size(640, 480), Size(1280, 960), Size(2560, 1920), Size(4000, 3000), Size(6000, 4000)};
+    int imagesPerSize = 5;
+    bool keep = false;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--bin" && i + 1 < argc) bin = argv[++i];
+            else if (arg == "--sizes" && i + 1 < argc) sizes = parseSizes(argv[++i]);
+            else if (arg == "--images" && i + 1 < argc) imagesPerSize = max(1, atoi(argv[++i]));
+            else if (arg == "--corpus" && i + 1 < argc) corpus = argv[++i];
+            else if (arg == "--reference-dir" && i + 1 < argc) referenceDir = argv[++i];
+            else if (arg == "--model" && i + 1 < argc) model = argv[++i];
+            else if (arg == "--model-norm" && i + 1 < argc) modelNorm = argv[++i];
+            else if (arg == "--json" && i + 1 < argc) jsonPath = argv[++i];
+            else if (arg == "--keep") keep = true;
+            else throw invalid_argument("Unknown argument: " + arg);
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+
+    char workTemplate[] = "/tmp/bg-remover-bench-XXXXXX";
+    if (!mkdtemp(workTemplate)) {
+        cerr << "Error: Could not create a work directory" << endl;
+        return 1;
+    }
+    string workDir = workTemplate;
+
+    // Presets use their own edge mode, so the other edge modes run on balanced
+    vector<BenchConfig> configs = {
+        {"fast", {"--grabcut", "-q", "fast"}},
+        {"balanced", {"--grabcut", "-q", "balanced"}},
+        {"balanced-blur", {"--grabcut", "-q", "balanced", "-e", "blur"}},
+        {"balanced-bilateral", {"--grabcut", "-q", "balanced", "-e", "bilateral"}},
+        {"balanced-fast-guided", {"--grabcut", "-q", "balanced", "-e", "fast-guided"}},
+        {"quality", {"--grabcut", "-q", "quality"}},
+        {"multires", {"--grabcut", "-q", "multires"}},
+    };
+    if (!model.empty()) {
+        configs.push_back({"ml", {"--ml", "--model", model, "--model-norm", modelNorm}});
+    }
+
+    // Image sets: one synthetic set per size, then the corpus
+    vector<ImageSet> sets;
+    for (const Size& size : sizes) {
+        ImageSet set;
+        set.name = to_string(size.width) + "x" + to_string(size.height);
+        set.dir = workDir + "/synthetic-" + set.name;
+        utils::fs::createDirectories(set.dir);
+        int count = size.area() >= kLargeScenePixels ? min(imagesPerSize, 2) : imagesPerSize;
+        for (int k = 0; k < count; k++) {
+            Mat image, truth;
+            makeSyntheticImage(size, 1000 * size.width + k, image, truth);
+            string file = "scene-" + to_string(k) + ".png";
+            imwrite(set.dir + "/" + file, image);
+            set.files.push_back(file);
+            set.truth.push_back(truth);
+        }
+        sets.push_back(set);
+    }
+    if (!corpus.empty()) {
+        ImageSet set;
+        set.name = "corpus";
+        set.dir = corpus;
+        vector<String> files;
+        glob(corpus, files, false);
+        sort(files.begin(), files.end());
+        for (const String& file : files) {
+            if (hasImageExtension(file)) {
+                set.files.push_back(file.substr(file.find_last_of('/') + 1));
+            }
+        }
+        sets.push_back(set);
+    }
+
+    vector<BenchResult> results;
+    printf("%-20s %-11s %6s %8s %10s %10s %9s %7s %9s\n",
+           "config", "set", "images", "img/s", "p50(ms)", "p99(ms)", "rss(MB)", "iou", "alpha-err");
+    for (const ImageSet& set : sets) {
+        // Corpus reference: saved masks, else the quality preset's output
+        vector<Mat> reference;
+        if (set.truth.empty() && !referenceDir.empty()) {
+            reference = loadOutputs(referenceDir, set);
+        }
+
+        // Run the reference configuration first so the others can be compared to it
+        vector<BenchConfig> ordered = configs;
+        if (set.truth.empty() && referenceDir.empty()) {
+            stable_partition(ordered.begin(), ordered.end(), [](const BenchConfig& c) { return c.name == "quality"; });
+        }
+
+        for (const BenchConfig& config : ordered) {
+            BenchResult r = runConfig(bin, config, set, workDir, reference);
+            if (set.truth.empty() && referenceDir.empty() && config.name == "quality") {
+                reference = loadOutputs(workDir + "/out-quality-" + set.name, set);
+            }
+            results.push_back(r);
+
+            printf("%-20s %-11s %6d %8.2f %10.1f %10.1f %9.1f ", r.config.c_str(), r.set.c_str(),
+                   r.images - r.failed, r.seconds > 0 ? r.images / r.seconds : 0, r.p50, r.p99, r.peakRssMB);
+            if (r.iou >= 0) printf("%7.4f %9.4f\n", r.iou, r.alphaError);
+            else printf("%7s %9s\n", "-", "-");
+            fflush(stdout);
+        }
+        printSpeedup(results, set.name);
+    }
+
+    writeJson(jsonPath, results);
+    cout << "Results written to " << jsonPath << endl;
+
+    if (!keep) {
+        utils::fs::remove_all(workDir);
+    } else {
+        cout << "Work directory kept: " << workDir << endl;
+    }
+
+    int failures = 0;
+    for (const BenchResult& r : results) failures += r.failed;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+// Micro-benchmark: original ML preprocessing/postprocessing path vs the fused
+// path in src/preprocess.hpp. Needs only OpenCV (no ONNX Runtime or model).
+//
+// Usage: preprocess-bench [runs]
+
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/preprocess.hpp"
+
+using namespace cv;
+using namespace std;
+
+const int kModelSize = 320;
+
+// Preprocessing as originally done in runMLSegmentation: resize, convert the
+// whole image to float, then a per-element NCHW copy into a fresh vector
+vector<float> preprocessOriginal(const Mat& image) {
+    Mat resized;
+    resize(image, resized, Size(kModelSize, kModelSize));
+    resized.convertTo(resized, CV_32FC3, 1.0 / 255.0);
+
+    vector<float> input_tensor_values(3 * kModelSize * kModelSize);
+    for (int c = 0; c < 3; c++) {
+        for (int h = 0; h < kModelSize; h++) {
+            for (int w = 0; w < kModelSize; w++) {
+                input_tensor_values[c * kModelSize * kModelSize + h * kModelSize + w] =
+                    resized.at<Vec3f>(h, w)[c];
+            }
+        }
+    }
+    return input_tensor_values;
+}
+
+// Postprocessing as originally done: full-size float resize, then convert
+Mat postprocessOriginal(const Mat& prob, Size size) {
+    Mat result_mask;
+    resize(prob, result_mask, size);
+    result_mask.convertTo(result_mask, CV_8UC1, 255.0);
+    return result_mask;
+}
+
+template <typename F>
+double timeMs(int runs, F fn) {
+    fn();  // warm caches and lazy allocations
+    int64 start = getTickCount();
+    for (int i = 0; i < runs; i++) {
+        fn();
+    }
+    return (getTickCount() - start) * 1000.0 / getTickFrequency() / runs;
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? stoi(argv[1]) : 50;
+    const Size sizes[] = {Size(1280, 960), Size(4000, 3000), Size(6000, 4000)};
+
+    // Deterministic synthetic input
+    RNG rng(12345);
+
+    cout << "size        pre-orig(ms)  pre-fused(ms)  speedup  post-orig(ms)  post-fused(ms)  speedup  max-diff" << endl;
+    for (const Size& size : sizes) {
+        Mat image(size, CV_8UC3);
+        rng.fill(image, RNG::UNIFORM, 0, 256);
+        GaussianBlur(image, image, Size(0, 0), 3.0);
+
+        Mat prob(kModelSize, kModelSize, CV_32F);
+        rng.fill(prob, RNG::UNIFORM, 0.0, 1.0);
+
+        TensorNormalization norm;
+        normalizationPreset("raw", norm);
+        vector<float> tensor(3 * kModelSize * kModelSize);
+        Mat resized, small, mask;
+        vector<Mat> planes;
+
+        double preOriginal = timeMs(runs, [&] { preprocessOriginal(image); });
+        double preFused = timeMs(runs, [&] {
+            fillTensorNCHW(image, Size(kModelSize, kModelSize), norm, tensor.data(), resized, planes);
+        });
+        double postOriginal = timeMs(runs, [&] { postprocessOriginal(prob, size); });
+        double postFused = timeMs(runs, [&] { tensorToMask(prob, size, small, mask); });
+
+        // The fused path resizes 8-bit data, so values may differ by rounding
+        vector<float> reference = preprocessOriginal(image);
+        fillTensorNCHW(image, Size(kModelSize, kModelSize), norm, tensor.data(), resized, planes);
+        double maxDiff = 0;
+        for (size_t i = 0; i < tensor.size(); i++) {
+            maxDiff = max(maxDiff, static_cast<double>(abs(tensor[i] - reference[i])));
+        }
+
+        printf("%-10s  %12.3f  %13.3f  %6.1fx  %13.3f  %14.3f  %6.1fx  %.4f\n",
+               (to_string(size.width) + "x" + to_string(size.height)).c_str(),
+               preOriginal, preFused, preOriginal / preFused,
+               postOriginal, postFused, postOriginal / postFused, maxDiff);
+    }
+    return 0;
+}
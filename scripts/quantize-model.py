@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Create INT8 and FP16 variants of an ONNX segmentation model.
+
+bg-remover loads them with --model-variant int8|fp16, which resolves
+<model>.onnx to <model>.int8.onnx / <model>.fp16.onnx next to the original.
+
+  int8 - dynamic quantization of weights to INT8. Smaller and usually faster
+         on CPU-only hosts, with a small accuracy cost.
+  fp16 - weights converted to float16, inputs and outputs kept float32, so
+         bg-remover can feed it the same tensors.
+
+Requires: pip install onnx onnxruntime onnxconverter-common
+
+Usage: scripts/quantize-model.py u2net.onnx [int8] [fp16]
+"""
+
+import os
+import sys
+
+
+def variant_path(model_path, variant):
+    stem, ext = os.path.splitext(model_path)
+    return f"{stem}.{variant}{ext or '.onnx'}"
+
+
+def make_int8(model_path):
+    from onnxruntime.quantization import QuantType, quantize_dynamic
+
+    out = variant_path(model_path, "int8")
+    quantize_dynamic(model_path, out, weight_type=QuantType.QUInt8)
+    return out
+
+
+def make_fp16(model_path):
+    import onnx
+    from onnxconverter_common import float16
+
+    out = variant_path(model_path, "fp16")
+    model = onnx.load(model_path)
+    onnx.save(float16.convert_float_to_float16(model, keep_io_types=True), out)
+    return out
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    model_path = sys.argv[1]
+    variants = sys.argv[2:] or ["int8", "fp16"]
+    builders = {"int8": make_int8, "fp16": make_fp16}
+
+    for variant in variants:
+        if variant not in builders:
+            print(f"Unknown variant: {variant} (use int8 or fp16)", file=sys.stderr)
+            return 1
+        out = builders[variant](model_path)
+        size_mb = os.path.getsize(out) / (1024 * 1024)
+        print(f"✅ {variant}: {out} ({size_mb:.1f} MB)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
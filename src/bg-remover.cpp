@@ -1,518 +1,493 @@
+// Command-line front end. The pipeline itself lives in pipeline.cpp, which is
+// also built into libbgremover (see bgremover.h).
+
 #include <opencv2/opencv.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
-// Check if opencv_contrib is available
-#if CV_VERSION_MAJOR >= 3 && __has_include(<opencv2/ximgproc.hpp>)
-#define HAVE_OPENCV_CONTRIB
-#include <opencv2/ximgproc.hpp>
-#endif
-
-#ifdef WITH_ML
-#include <onnxruntime/onnxruntime_cxx_api.h>
-#endif
+#include "mask_cache.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "preprocess.hpp"
 
 using namespace cv;
 using namespace std;
 
-// Processing options structure
-struct ProcessingOptions {
-    string quality = "balanced";
-    int iterations = 8;
-    int margin = -1;  // -1 = auto
-    string edgeMode = "guided";
-    bool verbose = false;
-    double kernelScale = 1.0;
-    bool useML = false;
-    string modelPath = "";
-};
-
-// Apply quality preset to options
-void applyPreset(ProcessingOptions& opts) {
-    if (opts.quality == "fast") {
-        opts.iterations = 5;
-        opts.edgeMode = "blur";
-        opts.kernelScale = 0.5;
-    } else if (opts.quality == "quality") {
-        opts.iterations = 12;
-        opts.edgeMode = "guided";
-        opts.kernelScale = 1.5;
-    }
-    // balanced is default (iterations=8, edgeMode="guided", kernelScale=1.0)
+// Exit code of a batch or sequence run: 0 when everything succeeded, the
+// budget exit code when every failure was a budget rejection, 1 otherwise
+int runExitCode(const RunSummary& summary) {
+    if (summary.failed == 0) return 0;
+    return summary.overBudget == summary.failed ? kExitBudgetExceeded : 1;
 }
 
-// Load image from file or stdin
-Mat loadImage(const string& path) {
-    if (path == "-") {
-        // Read from stdin
-        #ifdef _WIN32
-        _setmode(_fileno(stdin), _O_BINARY);
-        #endif
-
-        // Read entire stdin into buffer
-        vector<uchar> buffer(istreambuf_iterator<char>(cin), {});
-
-        if (buffer.empty()) {
-            cerr << "Error: No data received from stdin" << endl;
-            exit(1);
-        }
-
-        // Decode image from buffer
-        Mat img = imdecode(buffer, IMREAD_COLOR);
-
-        if (img.empty()) {
-            cerr << "Error: Could not decode image from stdin" << endl;
-            exit(1);
-        }
-
-        return img;
-    } else {
-        // Read from file
-        Mat img = imread(path, IMREAD_COLOR);
-
-        if (img.empty()) {
-            cerr << "Error: Could not open or find the image: " << path << endl;
-            exit(1);
-        }
-
-        return img;
-    }
-}
+int main(int argc, char** argv) {
+    string inputPath, outputPath, batchSource, sequenceSource, socketPath, metricsPath, maskCacheDir;
+    int maskCacheMB = 1024;
+    int workers = 0;     // 0 = one per CPU
+    int queueSize = 0;   // 0 = twice the worker count
+    int jobs = 1;        // batch pipeline workers, 0 = one per CPU
+    bool streamMode = false;
+    ProcessingOptions opts;
 
 #ifdef WITH_ML
-// Run ML-based segmentation using ONNX model
-Mat runMLSegmentation(const Mat& image, const string& modelPath, bool verbose) {
-    try {
-        // Initialize ONNX Runtime
-        Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "bg-remover");
-        Ort::SessionOptions session_options;
-        session_options.SetIntraOpNumThreads(1);
-        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
-
-        if (verbose) {
-            cerr << "Loading ML model: " << modelPath << endl;
-        }
-
-        // Load model
-        Ort::Session session(env, modelPath.c_str(), session_options);
-        Ort::AllocatorWithDefaultOptions allocator;
-
-        // Query input metadata from model
-        size_t num_input_nodes = session.GetInputCount();
-        if (num_input_nodes == 0) {
-            cerr << "Error: Model has no input nodes" << endl;
-            exit(1);
-        }
-
-        // Get first input name
-        Ort::AllocatedStringPtr input_name_ptr = session.GetInputNameAllocated(0, allocator);
-        string input_name_str(input_name_ptr.get());
-
-        // Get input shape
-        Ort::TypeInfo input_type_info = session.GetInputTypeInfo(0);
-        auto input_tensor_info = input_type_info.GetTensorTypeAndShapeInfo();
-        vector<int64_t> input_shape_vec = input_tensor_info.GetShape();
-
-        if (verbose) {
-            cerr << "Model input name: " << input_name_str << endl;
-            cerr << "Model input shape: [";
-            for (size_t i = 0; i < input_shape_vec.size(); i++) {
-                cerr << input_shape_vec[i];
-                if (i < input_shape_vec.size() - 1) cerr << ", ";
-            }
-            cerr << "]" << endl;
-        }
-
-        // Handle dynamic dimensions (-1 in shape) - use common defaults
-        int64_t batch_size = (input_shape_vec.size() > 0 && input_shape_vec[0] > 0) ? input_shape_vec[0] : 1;
-        int64_t channels = (input_shape_vec.size() > 1 && input_shape_vec[1] > 0) ? input_shape_vec[1] : 3;
-        int64_t input_height = (input_shape_vec.size() > 2 && input_shape_vec[2] > 0) ? input_shape_vec[2] : 320;
-        int64_t input_width = (input_shape_vec.size() > 3 && input_shape_vec[3] > 0) ? input_shape_vec[3] : 320;
-
-        if (verbose) {
-            cerr << "Using input dimensions: " << batch_size << "x" << channels << "x" << input_height << "x" << input_width << endl;
-        }
-
-        // Preprocess: resize and normalize
-        Mat resized;
-        resize(image, resized, Size(input_width, input_height));
-        resized.convertTo(resized, CV_32FC3, 1.0 / 255.0);
+    // ML mode is default when compiled with ML support
+    opts.useML = true;
+#endif
 
-        // Convert to tensor format (NCHW: batch, channels, height, width)
-        vector<float> input_tensor_values(batch_size * channels * input_height * input_width);
-        for (int c = 0; c < channels; c++) {
-            for (int h = 0; h < input_height; h++) {
-                for (int w = 0; w < input_width; w++) {
-                    input_tensor_values[c * input_height * input_width + h * input_width + w] =
-                        resized.at<Vec3f>(h, w)[c];
+    // Parse command line arguments
+    try {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if ((arg == "-i" || arg == "--input") && i + 1 < argc) {
+                inputPath = argv[++i];
+            } else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+                outputPath = argv[++i];
+            } else if ((arg == "-b" || arg == "--batch") && i + 1 < argc) {
+                batchSource = argv[++i];
+            } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+                jobs = parseIntOption("--jobs", argv[++i]);
+                if (jobs < 0) {
+                    throw invalid_argument("Jobs must be >= 0");
                 }
+            } else if (arg == "--sequence" && i + 1 < argc) {
+                sequenceSource = argv[++i];
+            } else if (arg == "--temporal-iterations" && i + 1 < argc) {
+                opts.temporalIterations = parseIntOption("--temporal-iterations", argv[++i]);
+                if (opts.temporalIterations < 1 || opts.temporalIterations > 20) {
+                    throw invalid_argument("Temporal iterations must be between 1 and 20");
+                }
+            } else if (arg == "--scene-cut" && i + 1 < argc) {
+                opts.sceneCut = parseDoubleOption("--scene-cut", argv[++i]);
+                if (opts.sceneCut <= 0 || opts.sceneCut > 1) {
+                    throw invalid_argument("Scene cut threshold must be between 0 (exclusive) and 1");
+                }
+            } else if (arg == "--skip-threshold" && i + 1 < argc) {
+                opts.mlSkipThreshold = parseDoubleOption("--skip-threshold", argv[++i]);
+                if (opts.mlSkipThreshold < 0 || opts.mlSkipThreshold >= 1) {
+                    throw invalid_argument("Skip threshold must be between 0 and 1 (exclusive of 1)");
+                }
+            } else if (arg == "--stream") {
+                streamMode = true;
+            } else if (arg == "--serve" && i + 1 < argc) {
+                socketPath = argv[++i];
+            } else if (arg == "--workers" && i + 1 < argc) {
+                workers = parseIntOption("--workers", argv[++i]);
+                if (workers < 1) {
+                    throw invalid_argument("Workers must be >= 1");
+                }
+            } else if (arg == "--queue-size" && i + 1 < argc) {
+                queueSize = parseIntOption("--queue-size", argv[++i]);
+                if (queueSize < 1) {
+                    throw invalid_argument("Queue size must be >= 1");
+                }
+            } else if ((arg == "-q" || arg == "--quality") && i + 1 < argc) {
+                setOption(opts, "quality", argv[++i]);
+            } else if ((arg == "-n" || arg == "--iterations") && i + 1 < argc) {
+                setOption(opts, "iterations", argv[++i]);
+            } else if ((arg == "-m" || arg == "--margin") && i + 1 < argc) {
+                setOption(opts, "margin", argv[++i]);
+            } else if ((arg == "-e" || arg == "--edge-mode") && i + 1 < argc) {
+                setOption(opts, "edge-mode", argv[++i]);
+            } else if (arg == "--adaptive") {
+                opts.adaptive = true;
+            } else if (arg == "--convergence" && i + 1 < argc) {
+                setOption(opts, "convergence", argv[++i]);
+            } else if (arg == "--tiled") {
+                opts.tiled = true;
+            } else if (arg == "--max-memory" && i + 1 < argc) {
+                opts.maxMemoryMB = parseIntOption("--max-memory", argv[++i]);
+                if (opts.maxMemoryMB < 1) {
+                    throw invalid_argument("Memory budget must be >= 1 MB");
+                }
+            } else if ((arg == "--max-pixels" || arg == "--max-decoded-mb" || arg == "--memory-ceiling-mb" ||
+                        arg == "--deadline-ms" || arg == "--over-budget") && i + 1 < argc) {
+                setBudgetOption(opts, arg.substr(2), argv[++i]);
+            } else if ((arg == "-f" || arg == "--format") && i + 1 < argc) {
+                opts.outputFormat = argv[++i];
+                if (!isOutputFormat(opts.outputFormat)) {
+                    throw invalid_argument("Invalid output format. Use: png, webp, qoi, mask, bgra, or alpha");
+                }
+            } else if ((arg == "-c" || arg == "--compression") && i + 1 < argc) {
+                setOption(opts, "compression", argv[++i]);
+            } else if (arg == "--metrics-json" && i + 1 < argc) {
+                metricsPath = argv[++i];
+            } else if (arg == "--mask-cache" && i + 1 < argc) {
+                maskCacheDir = argv[++i];
+            } else if (arg == "--mask-cache-size" && i + 1 < argc) {
+                maskCacheMB = parseIntOption("--mask-cache-size", argv[++i]);
+                if (maskCacheMB < 1) {
+                    throw invalid_argument("Mask cache size must be >= 1 MB");
+                }
+            } else if (arg == "-v" || arg == "--verbose") {
+                opts.verbose = true;
+            } else if (arg == "--ml") {
+                opts.useML = true;
+            } else if (arg == "--grabcut") {
+                opts.useML = false;
+            } else if (arg == "--model" && i + 1 < argc) {
+                opts.modelPath = argv[++i];
+            } else if (arg == "--model-norm" && i + 1 < argc) {
+                opts.modelNorm = argv[++i];
+                TensorNormalization norm;
+                if (!normalizationPreset(opts.modelNorm, norm)) {
+                    throw invalid_argument("Invalid model normalization. Use: raw, imagenet, or rmbg");
+                }
+            } else if (arg == "--model-variant" && i + 1 < argc) {
+                opts.modelVariant = argv[++i];
+                if (opts.modelVariant != "int8" && opts.modelVariant != "fp16") {
+                    throw invalid_argument("Invalid model variant. Use: int8 or fp16");
+                }
+            } else if (arg == "--no-model-cache") {
+                opts.modelCache = false;
+            } else if (arg == "--warmup") {
+                opts.warmup = true;
+            } else if (arg == "--ml-upsample" && i + 1 < argc) {
+                setOption(opts, "ml-upsample", argv[++i]);
+            } else if (arg == "--ml-batch" && i + 1 < argc) {
+                opts.mlBatchSize = parseIntOption("--ml-batch", argv[++i]);
+                if (opts.mlBatchSize < 1) {
+                    throw invalid_argument("ML batch size must be >= 1");
+                }
+            } else if (arg == "--intra-threads" && i + 1 < argc) {
+                opts.intraOpThreads = parseIntOption("--intra-threads", argv[++i]);
+                if (opts.intraOpThreads < 0) {
+                    throw invalid_argument("Intra-op threads must be >= 0");
+                }
+            } else if (arg == "--inter-threads" && i + 1 < argc) {
+                opts.interOpThreads = parseIntOption("--inter-threads", argv[++i]);
+                if (opts.interOpThreads < 0) {
+                    throw invalid_argument("Inter-op threads must be >= 0");
+                }
+            } else if (arg == "--execution-mode" && i + 1 < argc) {
+                string mode = argv[++i];
+                if (mode != "sequential" && mode != "parallel") {
+                    throw invalid_argument("Invalid execution mode. Use: sequential or parallel");
+                }
+                opts.parallelExecution = (mode == "parallel");
+            } else if (arg == "-h" || arg == "--help") {
+                cout << "Background Remover CLI" << endl;
+                cout << "Usage: bg-remover -i <input> -o <output> [options]" << endl;
+                cout << endl;
+                cout << "Required:" << endl;
+                cout << "  -i, --input <path>       Input image file path (use '-' for stdin)" << endl;
+                cout << "  -o, --output <path>      Output image file path (use '-' for stdout)" << endl;
+                cout << endl;
+                cout << "Options:" << endl;
+                cout << "  -q, --quality <preset>   Quality preset: fast, balanced, quality, multires" << endl;
+                cout << "                           (default: balanced)" << endl;
+                cout << "  -n, --iterations <n>     GrabCut iterations (1-20, default: 8)" << endl;
+                cout << "  -m, --margin <pixels>    Edge margin/inset in pixels (default: auto)" << endl;
+                cout << "  -e, --edge-mode <mode>   Edge refinement: blur, bilateral, guided, or" << endl;
+                cout << "                           fast-guided (guided filter fitted at 1/4 size)" << endl;
+                cout << "                           (default: guided)" << endl;
+                cout << "  --adaptive               Stop GrabCut early once the mask converges;" << endl;
+                cout << "                           -n becomes the maximum iteration count" << endl;
+                cout << "  --convergence <f>        Changed-pixel fraction treated as converged" << endl;
+                cout << "                           (implies --adaptive, default: 0.001)" << endl;
+                cout << "  -f, --format <format>    Output format: png, webp (lossless), qoi, mask (grayscale" << endl;
+                cout << "                           PNG), bgra or alpha (raw pixels, no header)" << endl;
+                cout << "                           (default: from the output extension, else png)" << endl;
+                cout << "  -c, --compression <lvl>  PNG compression 0-9, or fast (1), default (6), best (9)" << endl;
+                cout << "                           (default: 9)" << endl;
+                cout << "  --tiled                  Process in horizontal strips and stream the PNG out," << endl;
+                cout << "                           for images too large to process in one piece" << endl;
+                cout << "  --max-memory <MB>        Working memory budget beyond the decoded image;" << endl;
+                cout << "                           larger images are tiled automatically" << endl;
+                cout << "  -v, --verbose            Show detailed processing information" << endl;
+                cout << "  --metrics-json <dest>    Append per-stage wall/CPU times, dimensions, kernel" << endl;
+                cout << "                           sizes and peak RSS as JSON (one line per image) to a" << endl;
+                cout << "                           file, or to a file descriptor given as a number" << endl;
+                cout << "  --mask-cache <dir>       Reuse masks of previously seen inputs (same bytes and" << endl;
+                cout << "                           segmentation options) from this directory" << endl;
+                cout << "  --mask-cache-size <MB>   Mask cache limit; least recently used masks are evicted" << endl;
+                cout << "                           (default: 1024)" << endl;
+                cout << "  -b, --batch <source>     Process many images in one run; -o is then the output" << endl;
+                cout << "                           directory. Source is a directory, a glob pattern" << endl;
+                cout << "                           (quoted), or a manifest file with one input per line" << endl;
+                cout << "                           (optionally '<input><TAB><output>')" << endl;
+                cout << "  -j, --jobs <n>           Batch images processed concurrently, with decode," << endl;
+                cout << "                           segment, refine and encode pipelined across them" << endl;
+                cout << "                           (0 = one per CPU, default: 1)" << endl;
+                cout << "  --sequence <source>      Process a video or numbered frames ('frames/%04d.jpg')" << endl;
+                cout << "                           with GrabCut tracked from frame to frame; -o is a" << endl;
+                cout << "                           directory, a pattern ('out/%04d.png'), or one raw" << endl;
+                cout << "                           stream with -f bgra or alpha" << endl;
+                cout << "  --temporal-iterations <n> GrabCut iterations on tracked frames (default: 2)" << endl;
+                cout << "  --scene-cut <f>          Frame difference (0-1) that restarts GrabCut from" << endl;
+                cout << "                           scratch (default: 0.2)" << endl;
+                cout << "  --skip-threshold <f>     ML reuses the last mask below this frame difference" << endl;
+                cout << "                           (0 = never, default: 0.005)" << endl;
+                cout << "  -h, --help               Show this help message" << endl;
+                cout << endl;
+                cout << "Budget Options (per image, for untrusted inputs; 0 = none):" << endl;
+                cout << "  --max-pixels <n>         Largest width x height accepted" << endl;
+                cout << "  --max-decoded-mb <MB>    Largest decoded image; checked from the file header" << endl;
+                cout << "                           before decoding where possible" << endl;
+                cout << "  --memory-ceiling-mb <MB> Largest estimated peak memory for one image" << endl;
+                cout << "  --deadline-ms <ms>       Wall time limit, checked between stages and GrabCut" << endl;
+                cout << "                           iterations" << endl;
+                cout << "  --over-budget <action>   reject (exit code " << kExitBudgetExceeded
+                     << ") or downscale: segment a" << endl;
+                cout << "                           smaller copy to fit --max-pixels and" << endl;
+                cout << "                           --memory-ceiling-mb (default: reject)" << endl;
+                cout << endl;
+                cout << "Server Options:" << endl;
+                cout << "  --serve <socket>         Serve requests on a Unix domain socket with the model" << endl;
+                cout << "                           kept loaded (see INTEGRATION.md for the protocol)" << endl;
+                cout << "  --workers <n>            Worker threads (default: one per CPU)" << endl;
+                cout << "  --queue-size <n>         Accepted connections waiting for a worker before new" << endl;
+                cout << "                           clients are held back (default: 2x workers)" << endl;
+                cout << "  --stream                 Process framed requests from stdin and write framed" << endl;
+                cout << "                           responses to stdout, same protocol as --serve" << endl;
+                cout << endl;
+#ifdef WITH_ML
+                cout << "ML Options (ML enabled by default):" << endl;
+                cout << "  --model <path>           Path to ONNX model file (U2-Net, RMBG, etc.)" << endl;
+                cout << "  --model-norm <preset>    Input normalization: raw (BGR, 0-1), imagenet (U2-Net)," << endl;
+                cout << "                           rmbg (default: raw)" << endl;
+                cout << "  --model-variant <v>      Load <model>.int8.onnx or <model>.fp16.onnx instead" << endl;
+                cout << "                           (create with scripts/quantize-model.py)" << endl;
+                cout << "  --no-model-cache         Don't read or write the optimized graph cache" << endl;
+                cout << "                           (<model>.opt-<key>.onnx next to the model)" << endl;
+                cout << "  --warmup                 Run one dummy inference after loading the model" << endl;
+                cout << "  --ml-upsample <mode>     Scale the model mask to image size: linear or guided" << endl;
+                cout << "                           (follows image edges) (default: linear)" << endl;
+                cout << "  --ml-batch <n>           Images per inference in --batch mode, for models with" << endl;
+                cout << "                           a dynamic batch dimension (default: 1)" << endl;
+                cout << "  --intra-threads <n>      ONNX Runtime intra-op threads (0 = all cores, default: 1)" << endl;
+                cout << "  --inter-threads <n>      ONNX Runtime inter-op threads (default: ORT default)" << endl;
+                cout << "  --execution-mode <mode>  ONNX Runtime execution: sequential, parallel" << endl;
+                cout << "                           (default: sequential)" << endl;
+                cout << "  --grabcut                Use GrabCut algorithm instead of ML" << endl;
+                cout << "  --ml                     Force ML mode on (already default)" << endl;
+                cout << endl;
+#endif
+                cout << "Quality Presets:" << endl;
+                cout << "  fast      - Quick processing (5 iterations, blur)" << endl;
+                cout << "  balanced  - Good quality and speed (8 iterations, guided)" << endl;
+                cout << "  quality   - Best results (12 iterations, guided, 1.5x kernel)" << endl;
+                cout << "  multires  - Large photos (8 iterations at 1024px, boundary refined at full size)" << endl;
+                cout << endl;
+                cout << "Examples:" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png -q quality" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png -n 15 -e guided -v" << endl;
+                cout << "  bg-remover -i panorama.tif -o output.png --max-memory 512" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.qoi" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png -c fast" << endl;
+                cout << "  bg-remover -b ./photos -o ./processed" << endl;
+                cout << "  bg-remover -b './photos/*.jpg' -o ./processed -q fast" << endl;
+                cout << "  bg-remover -b manifest.txt -o ./processed -j 0" << endl;
+                cout << "  bg-remover --sequence spin.mp4 -o ./frames -q fast --grabcut" << endl;
+                cout << endl;
+                cout << "Piping workflows:" << endl;
+                cout << "  cat photo.jpg | bg-remover -i - -o output.png" << endl;
+                cout << "  bg-remover -i photo.jpg -o - > output.png" << endl;
+                cout << "  cat photo.jpg | bg-remover -i - -o - > output.png" << endl;
+                cout << "  curl https://example.com/photo.jpg | bg-remover -i - -o -" << endl;
+#ifdef WITH_ML
+                cout << endl;
+                cout << "ML mode examples (ML is default, just specify model):" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png --model u2net.onnx" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png --model rmbg-1.4.onnx" << endl;
+                cout << "  bg-remover -i photo.jpg -o output.png --grabcut  # Use GrabCut instead" << endl;
+#endif
+                return 0;
             }
         }
+    } catch (const invalid_argument& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
 
-        // Setup input tensor with actual shape from model
-        vector<int64_t> input_shape = {batch_size, channels, input_height, input_width};
-        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-        Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
-            memory_info, input_tensor_values.data(), input_tensor_values.size(),
-            input_shape.data(), input_shape.size());
-
-        // Query output metadata from model
-        size_t num_output_nodes = session.GetOutputCount();
-        if (num_output_nodes == 0) {
-            cerr << "Error: Model has no output nodes" << endl;
-            exit(1);
-        }
-
-        // Get first output name
-        Ort::AllocatedStringPtr output_name_ptr = session.GetOutputNameAllocated(0, allocator);
-        string output_name_str(output_name_ptr.get());
-
-        if (verbose) {
-            cerr << "Model output name: " << output_name_str << endl;
-            cerr << "Running ML inference..." << endl;
-        }
-
-        // Prepare input/output names for inference
-        const char* input_names[] = {input_name_str.c_str()};
-        const char* output_names[] = {output_name_str.c_str()};
-
-        // Run inference
-        auto output_tensors = session.Run(Ort::RunOptions{nullptr}, input_names, &input_tensor, 1,
-                                         output_names, 1);
-
-        // Get output tensor
-        float* output_data = output_tensors[0].GetTensorMutableData<float>();
-        auto output_shape = output_tensors[0].GetTensorTypeAndShapeInfo().GetShape();
-
-        if (verbose) {
-            cerr << "Output shape: [";
-            for (size_t i = 0; i < output_shape.size(); i++) {
-                cerr << output_shape[i];
-                if (i < output_shape.size() - 1) cerr << ", ";
-            }
-            cerr << "]" << endl;
-        }
+    bool batchMode = !batchSource.empty();
+    bool sequenceMode = !sequenceSource.empty();
+    bool serveMode = !socketPath.empty();
 
-        // Handle different output formats
-        Mat mask;
-        if (output_shape.size() == 4) {
-            // Format: [batch, channels, height, width] - extract first channel
-            int64_t out_height = output_shape[2];
-            int64_t out_width = output_shape[3];
-            mask = Mat(out_height, out_width, CV_32F, output_data);
-        } else if (output_shape.size() == 3) {
-            // Format: [batch, height, width]
-            int64_t out_height = output_shape[1];
-            int64_t out_width = output_shape[2];
-            mask = Mat(out_height, out_width, CV_32F, output_data);
-        } else if (output_shape.size() == 2) {
-            // Format: [height, width]
-            int64_t out_height = output_shape[0];
-            int64_t out_width = output_shape[1];
-            mask = Mat(out_height, out_width, CV_32F, output_data);
-        } else {
-            cerr << "Error: Unsupported output shape with " << output_shape.size() << " dimensions" << endl;
-            exit(1);
-        }
+    if (serveMode && streamMode) {
+        cerr << "Error: Use either --serve or --stream, not both." << endl;
+        return 1;
+    }
 
-        // Resize mask back to original size
-        Mat result_mask;
-        resize(mask, result_mask, image.size());
+    if (streamMode && (batchMode || sequenceMode || !inputPath.empty() || !outputPath.empty() ||
+                       !metricsPath.empty())) {
+        cerr << "Error: --stream cannot be combined with -i, -o, --batch, --sequence or --metrics-json." << endl;
+        return 1;
+    }
 
-        // Convert to 8-bit (0-255)
-        result_mask.convertTo(result_mask, CV_8UC1, 255.0);
+    if (!serveMode && !streamMode && ((inputPath.empty() && !batchMode && !sequenceMode) || outputPath.empty())) {
+        cerr << "Error: Both input and output paths are required." << endl;
+        cerr << "Usage: bg-remover -i <input> -o <output> [options]" << endl;
+        cerr << "Run 'bg-remover --help' for more information." << endl;
+        return 1;
+    }
 
-        if (verbose) {
-            cerr << "ML inference completed" << endl;
-        }
+    if (batchMode && !inputPath.empty()) {
+        cerr << "Error: Use either -i or --batch, not both." << endl;
+        return 1;
+    }
 
-        return result_mask;
+    if (sequenceMode && (batchMode || !inputPath.empty())) {
+        cerr << "Error: Use only one of -i, --batch or --sequence." << endl;
+        return 1;
+    }
 
-    } catch (const Ort::Exception& e) {
-        cerr << "ONNX Runtime error: " << e.what() << endl;
-        exit(1);
+    if (!maskCacheDir.empty() && (serveMode || streamMode || sequenceMode)) {
+        cerr << "Error: --mask-cache applies to -i and --batch only." << endl;
+        return 1;
     }
-}
-#endif
 
-// Save image to file or stdout
-void saveImage(const string& path, const Mat& img) {
-    vector<int> compression_params;
-    compression_params.push_back(IMWRITE_PNG_COMPRESSION);
-    compression_params.push_back(9);
+    if (jobs != 1 && !batchMode) {
+        cerr << "Error: --jobs requires --batch." << endl;
+        return 1;
+    }
 
-    if (path == "-") {
-        // Write to stdout
-        #ifdef _WIN32
-        _setmode(_fileno(stdout), _O_BINARY);
-        #endif
+    if (serveMode && (batchMode || sequenceMode || !inputPath.empty() || !outputPath.empty() ||
+                      !metricsPath.empty())) {
+        cerr << "Error: --serve cannot be combined with -i, -o, --batch, --sequence or --metrics-json." << endl;
+        return 1;
+    }
 
-        // Encode image to PNG buffer
-        vector<uchar> buffer;
-        if (!imencode(".png", img, buffer, compression_params)) {
-            cerr << "Error: Could not encode image to PNG" << endl;
-            exit(1);
+    // Metrics are appended to a file, or written to an inherited descriptor such as 3
+    unique_ptr<ostream> metricsOut;
+    if (!metricsPath.empty()) {
+#ifndef _WIN32
+        bool isDescriptor = metricsPath.find_first_not_of("0123456789") == string::npos;
+        if (isDescriptor) {
+            metricsOut.reset(new DescriptorStream(static_cast<int>(strtol(metricsPath.c_str(), nullptr, 10))));
         }
-
-        // Write buffer to stdout
-        cout.write(reinterpret_cast<char*>(buffer.data()), buffer.size());
-        cout.flush();
-    } else {
-        // Write to file
-        if (!imwrite(path, img, compression_params)) {
-            cerr << "Error: Could not save output image: " << path << endl;
-            exit(1);
+#endif
+        if (!metricsOut) metricsOut.reset(new ofstream(metricsPath, ios::out | ios::app));
+        if (!*metricsOut) {
+            cerr << "Error: Could not open metrics output: " << metricsPath << endl;
+            return 1;
         }
     }
-}
+    Metrics runMetrics;
 
-void removeBackground(const string& inputPath, const string& outputPath, const ProcessingOptions& opts) {
-    // Read input image (from file or stdin)
-    Mat image = loadImage(inputPath);
+    unique_ptr<MaskCache> maskCache;
+    if (!maskCacheDir.empty()) {
+        maskCache.reset(new MaskCache(maskCacheDir, static_cast<size_t>(maskCacheMB) * 1024 * 1024));
+    }
 
-    // Suppress verbose output when writing to stdout to avoid corrupting image data
-    bool showVerbose = opts.verbose && (outputPath != "-");
+    // Requests in server mode start from the options as given, before the preset
+    ProcessingOptions baseOpts = opts;
 
-    if (showVerbose) {
-        cout << "Image loaded: " << image.cols << "x" << image.rows << endl;
-        cout << "Processing options:" << endl;
-        cout << "  Mode: " << (opts.useML ? "ML" : "GrabCut") << endl;
-        if (!opts.useML) {
-            cout << "  Quality: " << opts.quality << endl;
-            cout << "  Iterations: " << opts.iterations << endl;
-            cout << "  Edge mode: " << opts.edgeMode << endl;
-            cout << "  Kernel scale: " << opts.kernelScale << endl;
-        }
-    }
+    // Apply quality preset
+    applyPreset(opts);
 
-    Mat mask2;
+#ifndef _WIN32
+    // Before any thread exists, so none of the model's or the server's threads
+    // can take the stop signals away from the server
+    if (serveMode) blockStopSignals();
+#endif
 
-#ifdef WITH_ML
+    // Load the ML model once; it is reused for every image in this process
+    shared_ptr<MLModel> model;
     if (opts.useML) {
-        // Use ML-based segmentation
+#ifdef WITH_ML
         if (opts.modelPath.empty()) {
             cerr << "Error: ML mode (default) requires --model <path> to specify model file" << endl;
             cerr << "       Use --grabcut to use the traditional GrabCut algorithm instead" << endl;
-            exit(1);
+            return 1;
+        }
+        try {
+            bool showVerbose = opts.verbose && outputPath != "-";
+            StageTimer loadTimer(&runMetrics, "ml_load");
+            model = loadModel(opts, showVerbose);
+            loadTimer.stop();
+            if (opts.warmup) {
+                StageTimer warmupTimer(&runMetrics, "ml_warmup");
+                warmupModel(*model, showVerbose);
+            }
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
         }
-        mask2 = runMLSegmentation(image, opts.modelPath, showVerbose);
-    } else
 #else
-    if (opts.useML) {
         cerr << "Error: ML mode not available. Binary was compiled without WITH_ML flag." << endl;
         cerr << "To use ML mode, rebuild with: make ML=1" << endl;
-        exit(1);
-    }
-#endif
-    {
-        // Use traditional GrabCut algorithm for background removal
-        Mat mask = Mat::zeros(image.size(), CV_8UC1);
-
-        int inset_x, inset_y;
-        if (opts.margin >= 0) {
-            // Use user-specified margin
-            inset_x = opts.margin;
-            inset_y = opts.margin;
-        } else {
-            // Proportional inset: 2% of dimensions or minimum 5px
-            inset_x = max(5, image.cols / 50);
-            inset_y = max(5, image.rows / 50);
-        }
-        Rect rectangle(inset_x, inset_y, image.cols - 2*inset_x, image.rows - 2*inset_y);
-        Mat bgModel, fgModel;
-
-        if (showVerbose) {
-            cout << "Processing image with GrabCut algorithm..." << endl;
-        }
-
-        // Run GrabCut
-        grabCut(image, mask, rectangle, bgModel, fgModel, opts.iterations, GC_INIT_WITH_RECT);
-
-        // Create binary mask (0 = background, 255 = foreground)
-        mask2 = (mask == GC_FGD) | (mask == GC_PR_FGD);
-        mask2.convertTo(mask2, CV_8UC1, 255);
-
-        // Apply morphological operations to clean up mask
-        // Calculate kernel size based on image dimensions and scale factor
-        int base_dim = min(image.cols, image.rows);
-        int kernel_size = max(3, min(15, static_cast<int>((base_dim / 150) * opts.kernelScale)));
-        if (kernel_size % 2 == 0) kernel_size++;  // Must be odd
-
-        Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(kernel_size, kernel_size));
-        morphologyEx(mask2, mask2, MORPH_CLOSE, kernel);
-        morphologyEx(mask2, mask2, MORPH_OPEN, kernel);
-
-        // Apply edge refinement based on selected mode
-        if (opts.edgeMode == "guided") {
-#ifdef HAVE_OPENCV_CONTRIB
-            // Edge-preserving guided filter for best boundary quality
-            Mat mask_float, image_gray, image_gray_float;
-            mask2.convertTo(mask_float, CV_32F, 1.0/255.0);
-
-            cvtColor(image, image_gray, COLOR_BGR2GRAY);
-            image_gray.convertTo(image_gray_float, CV_32F, 1.0/255.0);
-
-            int guide_radius = max(4, kernel_size);
-            double eps = 0.01;
-
-            Mat refined;
-            ximgproc::guidedFilter(image_gray_float, mask_float, refined, guide_radius, eps);
-            refined.convertTo(mask2, CV_8UC1, 255.0);
-#else
-            // Fallback to bilateral filter if opencv_contrib not available
-            Mat mask_float;
-            mask2.convertTo(mask_float, CV_32F);
-            Mat filtered;
-            bilateralFilter(mask_float, filtered, 9, 75, 75);
-            filtered.convertTo(mask2, CV_8UC1);
+        return 1;
 #endif
-        } else if (opts.edgeMode == "bilateral") {
-            // Bilateral filter for edge-preserving smoothing
-            Mat mask_float;
-            mask2.convertTo(mask_float, CV_32F);
-            Mat filtered;
-            bilateralFilter(mask_float, filtered, 9, 75, 75);
-            filtered.convertTo(mask2, CV_8UC1);
-        } else {
-            // Simple Gaussian blur (fast mode)
-            int blur_size = max(5, kernel_size * 2 + 1);
-            if (blur_size % 2 == 0) blur_size++;
-            double sigma = blur_size / 4.0;
-            GaussianBlur(mask2, mask2, Size(blur_size, blur_size), sigma);
-        }
     }
-    
-    // Create output image with alpha channel
-    Mat result;
-    vector<Mat> channels;
-    split(image, channels);
-    channels.push_back(mask2); // Add alpha channel
-    merge(channels, result);
 
-    // Save output (to file or stdout)
-    saveImage(outputPath, result);
-
-    // Success message (skip for stdout to avoid mixing with image data)
-    if (outputPath != "-") {
-        cout << "✅ Background removed successfully → " << outputPath << endl;
+#ifndef _WIN32
+    if (serveMode) {
+        return runServer(socketPath, baseOpts, model.get(), workers, queueSize);
+    }
+    if (streamMode) {
+        return runStream(baseOpts, model.get());
+    }
+#else
+    if (serveMode || streamMode) {
+        cerr << "Error: Server and stream modes are not supported on Windows." << endl;
+        return 1;
     }
-}
-
-int main(int argc, char** argv) {
-    string inputPath, outputPath;
-    ProcessingOptions opts;
-
-#ifdef WITH_ML
-    // ML mode is default when compiled with ML support
-    opts.useML = true;
 #endif
 
-    // Parse command line arguments
-    for (int i = 1; i < argc; i++) {
-        string arg = argv[i];
-        if ((arg == "-i" || arg == "--input") && i + 1 < argc) {
-            inputPath = argv[++i];
-        } else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
-            outputPath = argv[++i];
-        } else if ((arg == "-q" || arg == "--quality") && i + 1 < argc) {
-            opts.quality = argv[++i];
-            if (opts.quality != "fast" && opts.quality != "balanced" && opts.quality != "quality") {
-                cerr << "Error: Invalid quality preset. Use: fast, balanced, or quality" << endl;
+    try {
+        if (batchMode) {
+            vector<BatchItem> items = collectBatch(batchSource, outputPath, outputExtension(opts.outputFormat));
+            if (items.empty()) {
+                cerr << "Error: No input images found for batch: " << batchSource << endl;
                 return 1;
             }
-        } else if ((arg == "-n" || arg == "--iterations") && i + 1 < argc) {
-            opts.iterations = stoi(argv[++i]);
-            if (opts.iterations < 1 || opts.iterations > 20) {
-                cerr << "Error: Iterations must be between 1 and 20" << endl;
-                return 1;
+            utils::fs::createDirectories(outputPath);
+            if (jobs == 0) jobs = max(1, getNumberOfCPUs());
+            RunSummary summary = jobs > 1
+                ? runBatchPipelined(items, opts, model.get(), jobs, metricsOut.get(), maskCache.get())
+                : runBatch(items, opts, model.get(), metricsOut.get(), maskCache.get());
+            if (maskCache && opts.verbose) {
+                cout << "Mask cache: " << maskCache->hitCount() << " hits, " << maskCache->missCount() << " misses"
+                     << endl;
             }
-        } else if ((arg == "-m" || arg == "--margin") && i + 1 < argc) {
-            opts.margin = stoi(argv[++i]);
-            if (opts.margin < 0) {
-                cerr << "Error: Margin must be >= 0" << endl;
-                return 1;
+
+            // Closing line with the costs shared by the whole run
+            if (metricsOut) {
+                runMetrics.set("batch", batchSource);
+                runMetrics.set("images", static_cast<double>(items.size()));
+                runMetrics.set("failed", summary.failed);
+                if (maskCache) {
+                    runMetrics.set("mask_cache_hits", maskCache->hitCount());
+                    runMetrics.set("mask_cache_misses", maskCache->missCount());
+                }
+                runMetrics.set("peak_rss_bytes", static_cast<double>(peakRssBytes()));
+                *metricsOut << runMetrics.toJson() << endl;
             }
-        } else if ((arg == "-e" || arg == "--edge-mode") && i + 1 < argc) {
-            opts.edgeMode = argv[++i];
-            if (opts.edgeMode != "blur" && opts.edgeMode != "bilateral" && opts.edgeMode != "guided") {
-                cerr << "Error: Invalid edge mode. Use: blur, bilateral, or guided" << endl;
-                return 1;
+            return runExitCode(summary);
+        }
+        if (sequenceMode) {
+            RunSummary summary = runSequence(sequenceSource, outputPath, opts, model.get(), metricsOut.get());
+            if (metricsOut) {
+                runMetrics.set("sequence", sequenceSource);
+                runMetrics.set("failed", summary.failed);
+                runMetrics.set("peak_rss_bytes", static_cast<double>(peakRssBytes()));
+                *metricsOut << runMetrics.toJson() << endl;
             }
-        } else if (arg == "-v" || arg == "--verbose") {
-            opts.verbose = true;
-        } else if (arg == "--ml") {
-            opts.useML = true;
-        } else if (arg == "--grabcut") {
-            opts.useML = false;
-        } else if (arg == "--model" && i + 1 < argc) {
-            opts.modelPath = argv[++i];
-        } else if (arg == "-h" || arg == "--help") {
-            cout << "Background Remover CLI" << endl;
-            cout << "Usage: bg-remover -i <input> -o <output> [options]" << endl;
-            cout << endl;
-            cout << "Required:" << endl;
-            cout << "  -i, --input <path>       Input image file path (use '-' for stdin)" << endl;
-            cout << "  -o, --output <path>      Output image file path (use '-' for stdout)" << endl;
-            cout << endl;
-            cout << "Options:" << endl;
-            cout << "  -q, --quality <preset>   Quality preset: fast, balanced, quality" << endl;
-            cout << "                           (default: balanced)" << endl;
-            cout << "  -n, --iterations <n>     GrabCut iterations (1-20, default: 8)" << endl;
-            cout << "  -m, --margin <pixels>    Edge margin/inset in pixels (default: auto)" << endl;
-            cout << "  -e, --edge-mode <mode>   Edge refinement: blur, bilateral, guided" << endl;
-            cout << "                           (default: guided)" << endl;
-            cout << "  -v, --verbose            Show detailed processing information" << endl;
-            cout << "  -h, --help               Show this help message" << endl;
-            cout << endl;
-#ifdef WITH_ML
-            cout << "ML Options (ML enabled by default):" << endl;
-            cout << "  --model <path>           Path to ONNX model file (U2-Net, RMBG, etc.)" << endl;
-            cout << "  --grabcut                Use GrabCut algorithm instead of ML" << endl;
-            cout << "  --ml                     Force ML mode on (already default)" << endl;
-            cout << endl;
-#endif
-            cout << "Quality Presets:" << endl;
-            cout << "  fast      - Quick processing (5 iterations, blur)" << endl;
-            cout << "  balanced  - Good quality and speed (8 iterations, guided)" << endl;
-            cout << "  quality   - Best results (12 iterations, guided, 1.5x kernel)" << endl;
-            cout << endl;
-            cout << "Examples:" << endl;
-            cout << "  bg-remover -i photo.jpg -o output.png" << endl;
-            cout << "  bg-remover -i photo.jpg -o output.png -q quality" << endl;
-            cout << "  bg-remover -i photo.jpg -o output.png -n 15 -e guided -v" << endl;
-            cout << endl;
-            cout << "Piping workflows:" << endl;
-            cout << "  cat photo.jpg | bg-remover -i - -o output.png" << endl;
-            cout << "  bg-remover -i photo.jpg -o - > output.png" << endl;
-            cout << "  cat photo.jpg | bg-remover -i - -o - > output.png" << endl;
-            cout << "  curl https://example.com/photo.jpg | bg-remover -i - -o -" << endl;
-#ifdef WITH_ML
-            cout << endl;
-            cout << "ML mode examples (ML is default, just specify model):" << endl;
-            cout << "  bg-remover -i photo.jpg -o output.png --model u2net.onnx" << endl;
-            cout << "  bg-remover -i photo.jpg -o output.png --model rmbg-1.4.onnx" << endl;
-            cout << "  bg-remover -i photo.jpg -o output.png --grabcut  # Use GrabCut instead" << endl;
-#endif
-            return 0;
+            return runExitCode(summary);
         }
-    }
-
-    if (inputPath.empty() || outputPath.empty()) {
-        cerr << "Error: Both input and output paths are required." << endl;
-        cerr << "Usage: bg-remover -i <input> -o <output> [options]" << endl;
-        cerr << "Run 'bg-remover --help' for more information." << endl;
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
         return 1;
     }
 
-    // Apply quality preset
-    applyPreset(opts);
-
+    // Single image: model loading is reported with the image it was loaded for
+    Metrics metrics = runMetrics;
     try {
-        removeBackground(inputPath, outputPath, opts);
+        removeBackground(inputPath, outputPath, opts, model.get(), metricsOut ? &metrics : nullptr, maskCache.get());
     } catch (const exception& e) {
+        if (metricsOut) writeMetrics(*metricsOut, metrics, inputPath, outputPath, e.what());
         cerr << "Error: " << e.what() << endl;
-        return 1;
+        return isOverBudget(e) ? kExitBudgetExceeded : 1;
     }
+    if (metricsOut) writeMetrics(*metricsOut, metrics, inputPath, outputPath, "");
 
     return 0;
-}
\ No newline at end of file
+}
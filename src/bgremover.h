@@ -0,0 +1,100 @@
+#ifndef BGREMOVER_H
+#define BGREMOVER_H
+
+/*
+ * libbgremover: background removal in-process, without spawning bg-remover.
+ *
+ * A context holds the processing options and the loaded ML model, and is
+ * reused for any number of images. Results are written to memory the caller
+ * provides. Functions return a status code and never exit the process; the
+ * message for the last failure is available from bgr_last_error().
+ *
+ * A context must not be used by two threads at once. Use one context per
+ * thread (each loads its own model), or serialize calls.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32) && defined(BGR_BUILD_SHARED)
+#define BGR_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define BGR_API __attribute__((visibility("default")))
+#else
+#define BGR_API
+#endif
+
+/* Incremented when a function signature or status value changes */
+#define BGR_ABI_VERSION 2
+
+typedef enum {
+    BGR_OK = 0,
+    BGR_ERROR_INVALID_ARGUMENT = 1,  /* bad option, format, pointer or size */
+    BGR_ERROR_DECODE = 2,            /* input bytes are not a supported image */
+    BGR_ERROR_MODEL = 3,             /* model could not be loaded */
+    BGR_ERROR_UNSUPPORTED = 4,       /* e.g. ML requested from a build without ML */
+    BGR_ERROR_BUFFER_TOO_SMALL = 5,  /* *out_size holds the size needed; see bgr_copy_result */
+    BGR_ERROR_OUT_OF_MEMORY = 6,
+    BGR_ERROR_PROCESSING = 7,        /* segmentation or encoding failed */
+    BGR_ERROR_BUDGET_EXCEEDED = 8    /* image over a budget option, or past its deadline */
+} bgr_status;
+
+typedef struct bgr_context bgr_context;
+
+BGR_API int bgr_abi_version(void);
+
+/*
+ * Create a context. `options` is NULL or "key=value" lines:
+ *   quality, iterations, margin, edge-mode, adaptive, convergence, mode,
+ *   compression   - as in the server protocol (see INTEGRATION.md)
+ *   model         - ONNX model path; selects ML mode
+ *   model-norm    - raw, imagenet or rmbg
+ *   model-variant - int8 or fp16
+ *   intra-threads - ONNX Runtime intra-op threads
+ *   warmup        - true runs one dummy inference before returning
+ *   max-pixels, max-decoded-mb, memory-ceiling-mb, deadline-ms,
+ *   over-budget   - per-image budgets, as the command-line flags of the
+ *                   same names (see INTEGRATION.md)
+ * Like sqlite3_open, *ctx is set even on failure so bgr_last_error() can
+ * explain it; it must still be passed to bgr_context_destroy(). *ctx is NULL
+ * only if memory for the context itself could not be allocated.
+ */
+BGR_API bgr_status bgr_context_create(const char* options, bgr_context** ctx);
+
+BGR_API void bgr_context_destroy(bgr_context* ctx);
+
+/* Change one processing option (same names as above, except the model ones) */
+BGR_API bgr_status bgr_set_option(bgr_context* ctx, const char* name, const char* value);
+
+/* Message for the last failed call on this context, or "" */
+BGR_API const char* bgr_last_error(const bgr_context* ctx);
+
+/*
+ * Remove the background from an encoded image (JPEG, PNG, WebP, ...).
+ * `format` is one of the output formats: png, webp, qoi, mask (grayscale
+ * PNG), bgra (raw, width * height * 4 bytes) or alpha (raw, width * height).
+ * The result is written to `out` and its size to *out_size. If `capacity` is
+ * too small, BGR_ERROR_BUFFER_TOO_SMALL is returned with the size needed in
+ * *out_size, and the result is kept for bgr_copy_result().
+ */
+BGR_API bgr_status bgr_process_encoded(bgr_context* ctx, const void* data, size_t size, const char* format,
+                                       void* out, size_t capacity, size_t* out_size);
+
+/*
+ * Same as bgr_process_encoded for raw 8-bit BGR pixels, `stride` bytes per
+ * row (at least width * 3). The pixels are not modified or retained.
+ */
+BGR_API bgr_status bgr_process_bgr(bgr_context* ctx, const void* pixels, int width, int height, size_t stride,
+                                   const char* format, void* out, size_t capacity, size_t* out_size);
+
+/* Copy a result kept after BGR_ERROR_BUFFER_TOO_SMALL, without processing again */
+BGR_API bgr_status bgr_copy_result(bgr_context* ctx, void* out, size_t capacity, size_t* out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+// C ABI over the pipeline (see bgremover.h). Every entry point catches
+// exceptions and turns them into a status code plus bgr_last_error().
+
+#include "bgremover.h"
+
+#include <opencv2/opencv.hpp>
+#include <climits>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pipeline.hpp"
+#include "preprocess.hpp"
+
+using namespace cv;
+using namespace std;
+
+struct bgr_context {
+    ProcessingOptions opts;      // as configured; the preset is applied per call
+    shared_ptr<MLModel> model;
+    string lastError;
+    vector<uchar> result;        // encoded result; reused, so it stops allocating once grown
+    bool pending = false;        // result kept after BGR_ERROR_BUFFER_TOO_SMALL
+};
+
+namespace {
+
+// Failures that map to a specific status code
+struct StatusError : runtime_error {
+    StatusError(bgr_status status, const string& message) : runtime_error(message), status(status) {}
+    bgr_status status;
+};
+
+bgr_status fail(bgr_context* ctx, bgr_status status, const string& message) {
+    if (ctx) ctx->lastError = message;
+    return status;
+}
+
+// Run an entry point, converting exceptions to status codes
+template <typename F>
+bgr_status guarded(bgr_context* ctx, F fn) {
+    try {
+        if (ctx) ctx->lastError.clear();
+        return fn();
+    } catch (const StatusError& e) {
+        return fail(ctx, e.status, e.what());
+    } catch (const BudgetExceeded& e) {
+        return fail(ctx, BGR_ERROR_BUDGET_EXCEEDED, e.what());
+    } catch (const invalid_argument& e) {
+        return fail(ctx, BGR_ERROR_INVALID_ARGUMENT, e.what());
+    } catch (const bad_alloc&) {
+        return fail(ctx, BGR_ERROR_OUT_OF_MEMORY, "Out of memory");
+    } catch (const exception& e) {
+        return fail(ctx, BGR_ERROR_PROCESSING, e.what());
+    } catch (...) {
+        return fail(ctx, BGR_ERROR_PROCESSING, "Unknown error");
+    }
+}
+
+// Options that only make sense when creating a context (they pick and load
+// the model); everything else goes through setOption
+bool setModelOption(ProcessingOptions& opts, const string& name, const string& value) {
+    if (name == "model") {
+        opts.modelPath = value;
+        opts.useML = true;
+    } else if (name == "model-norm") {
+        TensorNormalization norm;
+        if (!normalizationPreset(value, norm)) {
+            throw invalid_argument("Invalid model normalization. Use: raw, imagenet, or rmbg");
+        }
+        opts.modelNorm = value;
+    } else if (name == "model-variant") {
+        if (value != "int8" && value != "fp16") {
+            throw invalid_argument("Invalid model variant. Use: int8 or fp16");
+        }
+        opts.modelVariant = value;
+    } else if (name == "intra-threads") {
+        opts.intraOpThreads = parseIntOption(name, value);
+        if (opts.intraOpThreads < 0) {
+            throw invalid_argument("Intra-op threads must be >= 0");
+        }
+    } else if (name == "warmup") {
+        if (value != "true" && value != "false") {
+            throw invalid_argument("Invalid value for warmup. Use: true or false");
+        }
+        opts.warmup = (value == "true");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void parseContextOptions(const char* options, ProcessingOptions& opts) {
+    if (!options) return;
+    istringstream lines(options);
+    string line;
+    while (getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        size_t eq = line.find('=');
+        if (eq == string::npos) {
+            throw invalid_argument("Malformed option line: " + line);
+        }
+        string name = line.substr(0, eq);
+        string value = line.substr(eq + 1);
+        if (!setModelOption(opts, name, value) && !setBudgetOption(opts, name, value)) {
+            setOption(opts, name, value);
+        }
+    }
+}
+
+// Hand the pending result to the caller, or report the size it needs
+bgr_status deliver(bgr_context* ctx, void* out, size_t capacity, size_t* out_size) {
+    *out_size = ctx->result.size();
+    if (capacity < ctx->result.size() || (!out && !ctx->result.empty())) {
+        ctx->pending = true;
+        return fail(ctx, BGR_ERROR_BUFFER_TOO_SMALL,
+                    "Output buffer too small: " + to_string(ctx->result.size()) + " bytes needed");
+    }
+    memcpy(out, ctx->result.data(), ctx->result.size());
+    ctx->pending = false;
+    return BGR_OK;
+}
+
+// Options for one call, with its deadline started. Taken before any decoding,
+// so the deadline covers the whole call.
+ProcessingOptions callOptions(const bgr_context* ctx) {
+    ProcessingOptions opts = ctx->opts;
+    applyPreset(opts);
+    if (opts.useML && !ctx->model) {
+        throw StatusError(BGR_ERROR_INVALID_ARGUMENT, "ML mode requires a context created with model=<path>");
+    }
+    startDeadline(opts);
+    return opts;
+}
+
+bgr_status process(bgr_context* ctx, const Mat& image, const ProcessingOptions& opts, const char* format,
+                   void* out, size_t capacity, size_t* out_size) {
+    string outputFormat = format ? format : "";
+    if (!isOutputFormat(outputFormat)) {
+        throw invalid_argument("Invalid format. Use: png, webp, qoi, mask, bgra, or alpha");
+    }
+
+    ctx->pending = false;
+    Mat mask = computeMask(image, opts, ctx->model.get(), false);
+    encodeOutput(image, mask, outputFormat, opts.compression, ctx->result);
+    return deliver(ctx, out, capacity, out_size);
+}
+
+}  // namespace
+
+extern "C" {
+
+int bgr_abi_version(void) {
+    return BGR_ABI_VERSION;
+}
+
+bgr_status bgr_context_create(const char* options, bgr_context** ctx) {
+    if (!ctx) return BGR_ERROR_INVALID_ARGUMENT;
+    *ctx = new (nothrow) bgr_context();
+    if (!*ctx) return BGR_ERROR_OUT_OF_MEMORY;
+
+    bgr_context* context = *ctx;
+    return guarded(context, [&] {
+        parseContextOptions(options, context->opts);
+        if (!context->opts.useML) return BGR_OK;
+#ifdef WITH_ML
+        if (context->opts.modelPath.empty()) {
+            throw invalid_argument("ML mode requires model=<path>");
+        }
+        try {
+            context->model = loadModel(context->opts, false);
+            // The context is used by one thread at a time, but not always the same one
+            shareModelScratch(*context->model);
+            if (context->opts.warmup) warmupModel(*context->model, false);
+        } catch (const exception& e) {
+            throw StatusError(BGR_ERROR_MODEL, e.what());
+        }
+        return BGR_OK;
+#else
+        throw StatusError(BGR_ERROR_UNSUPPORTED, "ML mode not available: library built without WITH_ML");
+#endif
+    });
+}
+
+void bgr_context_destroy(bgr_context* ctx) {
+    delete ctx;
+}
+
+bgr_status bgr_set_option(bgr_context* ctx, const char* name, const char* value) {
+    if (!ctx) return BGR_ERROR_INVALID_ARGUMENT;
+    return guarded(ctx, [&] {
+        if (!name || !value) {
+            throw invalid_argument("Option name and value are required");
+        }
+        ProcessingOptions opts = ctx->opts;
+        if (!setBudgetOption(opts, name, value)) {
+            setOption(opts, name, value);
+        }
+        if (opts.useML && !ctx->model) {
+            throw invalid_argument("ML mode requires a context created with model=<path>");
+        }
+        ctx->opts = opts;
+        return BGR_OK;
+    });
+}
+
+const char* bgr_last_error(const bgr_context* ctx) {
+    return ctx ? ctx->lastError.c_str() : "";
+}
+
+bgr_status bgr_process_encoded(bgr_context* ctx, const void* data, size_t size, const char* format,
+                               void* out, size_t capacity, size_t* out_size) {
+    if (!ctx) return BGR_ERROR_INVALID_ARGUMENT;
+    return guarded(ctx, [&] {
+        if (!data || size == 0 || !out_size) {
+            throw invalid_argument("Input data and out_size are required");
+        }
+        if (size > static_cast<size_t>(INT_MAX)) {
+            throw invalid_argument("Input data too large: " + to_string(size) + " bytes");
+        }
+        ProcessingOptions opts = callOptions(ctx);
+        Mat image = decodeAdmittedImage(data, size, opts);
+        if (image.empty()) {
+            throw StatusError(BGR_ERROR_DECODE, "Could not decode image");
+        }
+        return process(ctx, image, opts, format, out, capacity, out_size);
+    });
+}
+
+bgr_status bgr_process_bgr(bgr_context* ctx, const void* pixels, int width, int height, size_t stride,
+                           const char* format, void* out, size_t capacity, size_t* out_size) {
+    if (!ctx) return BGR_ERROR_INVALID_ARGUMENT;
+    return guarded(ctx, [&] {
+        if (!pixels || width <= 0 || height <= 0 || stride < static_cast<size_t>(width) * 3 || !out_size) {
+            throw invalid_argument("Invalid pixel buffer");
+        }
+        ProcessingOptions opts = callOptions(ctx);
+        Mat image(height, width, CV_8UC3, const_cast<void*>(pixels), stride);
+        return process(ctx, image, opts, format, out, capacity, out_size);
+    });
+}
+
+bgr_status bgr_copy_result(bgr_context* ctx, void* out, size_t capacity, size_t* out_size) {
+    if (!ctx) return BGR_ERROR_INVALID_ARGUMENT;
+    return guarded(ctx, [&] {
+        if (!out_size) {
+            throw invalid_argument("out_size is required");
+        }
+        if (!ctx->pending) {
+            throw invalid_argument("No pending result");
+        }
+        return deliver(ctx, out, capacity, out_size);
+    });
+}
+
+}  // extern "C"
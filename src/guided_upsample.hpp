@@ -0,0 +1,116 @@
+#ifndef BG_REMOVER_GUIDED_UPSAMPLE_HPP
+#define BG_REMOVER_GUIDED_UPSAMPLE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+
+// Fast guided filter (He & Sun, "Fast Guided Filter", 2015). The guided
+// filter's per-pixel linear model q = a * I + b is fitted on a copy of the
+// guide and the mask at `workSize`, and the smoothed coefficients are then
+// upsampled and applied to the full-resolution guide strip by strip. The
+// result follows the guide's edges like a full-resolution guided filter at a
+// fraction of the cost, without any full-resolution float buffers.
+//
+// `guide` is the full-resolution 8-bit BGR or gray image; its luma is the
+// guidance signal. `mask` is 8-bit at any size (e.g. a model's 320x320
+// output) and is resized to `workSize`. `radius` is in work-resolution
+// pixels. `out` receives an 8-bit mask the size of `guide` and may be `mask`.
+inline void fastGuidedFilter(const cv::Mat& guide, const cv::Mat& mask, cv::Mat& out, int radius, double eps,
+                             cv::Size workSize) {
+    CV_Assert(guide.depth() == CV_8U && (guide.channels() == 3 || guide.channels() == 1));
+    CV_Assert(mask.type() == CV_8UC1 && workSize.area() > 0);
+
+    // Guide and mask at the working resolution, in [0, 1]
+    cv::Mat smallGuide, smallGray, I, p, smallMask;
+    cv::resize(guide, smallGuide, workSize, 0, 0, cv::INTER_AREA);
+    if (smallGuide.channels() == 3) {
+        cv::cvtColor(smallGuide, smallGray, cv::COLOR_BGR2GRAY);
+    } else {
+        smallGray = smallGuide;
+    }
+    smallGray.convertTo(I, CV_32F, 1.0 / 255.0);
+    if (mask.size() == workSize) {
+        smallMask = mask;
+    } else {
+        bool shrinking = mask.cols > workSize.width || mask.rows > workSize.height;
+        cv::resize(mask, smallMask, workSize, 0, 0, shrinking ? cv::INTER_AREA : cv::INTER_LINEAR);
+    }
+    smallMask.convertTo(p, CV_32F, 1.0 / 255.0);
+
+    // Guided filter coefficients (He et al. 2010, algorithm 1)
+    cv::Size box(2 * radius + 1, 2 * radius + 1);
+    auto boxMean = [&box](const cv::Mat& src, cv::Mat& dst) {
+        cv::boxFilter(src, dst, CV_32F, box, cv::Point(-1, -1), true, cv::BORDER_REFLECT);
+    };
+    cv::Mat meanI, meanP, corrI, corrIp;
+    boxMean(I, meanI);
+    boxMean(p, meanP);
+    boxMean(I.mul(I), corrI);
+    boxMean(I.mul(p), corrIp);
+    cv::Mat varI = corrI - meanI.mul(meanI);
+    cv::Mat covIp = corrIp - meanI.mul(meanP);
+    cv::Mat a = covIp / (varI + eps);
+    cv::Mat b = meanP - a.mul(meanI);
+    cv::Mat meanA, meanB;
+    boxMean(a, meanA);
+    boxMean(b, meanB);
+
+    // Upsample the coefficients and apply them to the full-resolution guide
+    // in row strips, so the only full-size buffer is `out`. Per strip, the
+    // work-resolution rows of a and b are interpolated vertically, resized
+    // horizontally to full width (the same bilinear mapping as resizing the
+    // whole image), and q = a * I + b is written as 8-bit in one row loop.
+    // b is pre-scaled by 255 so the loop works on the guide's 8-bit luma.
+    cv::Mat scaledB = meanB * 255.0;
+    out.create(guide.size(), CV_8UC1);
+    const int stripRows = 64;
+    int strips = (guide.rows + stripRows - 1) / stripRows;
+    double scaleY = static_cast<double>(workSize.height) / guide.rows;
+
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range& range) {
+        cv::Mat stripA, stripB, fullA, fullB, gray;
+        for (int strip = range.start; strip < range.end; strip++) {
+            int y0 = strip * stripRows;
+            int y1 = std::min(guide.rows, y0 + stripRows);
+            stripA.create(y1 - y0, workSize.width, CV_32F);
+            stripB.create(y1 - y0, workSize.width, CV_32F);
+            for (int y = y0; y < y1; y++) {
+                double f = (y + 0.5) * scaleY - 0.5;
+                int i0 = static_cast<int>(std::floor(f));
+                float w = static_cast<float>(f - i0);
+                if (i0 < 0) {
+                    i0 = 0;
+                    w = 0;
+                }
+                if (i0 >= workSize.height - 1) {
+                    i0 = workSize.height - 1;
+                    w = 0;
+                }
+                int i1 = std::min(i0 + 1, workSize.height - 1);
+                cv::addWeighted(meanA.row(i0), 1.0 - w, meanA.row(i1), w, 0.0, stripA.row(y - y0));
+                cv::addWeighted(scaledB.row(i0), 1.0 - w, scaledB.row(i1), w, 0.0, stripB.row(y - y0));
+            }
+            cv::resize(stripA, fullA, cv::Size(guide.cols, y1 - y0), 0, 0, cv::INTER_LINEAR);
+            cv::resize(stripB, fullB, cv::Size(guide.cols, y1 - y0), 0, 0, cv::INTER_LINEAR);
+
+            cv::Mat guideRows = guide.rowRange(y0, y1);
+            if (guide.channels() == 3) {
+                cv::cvtColor(guideRows, gray, cv::COLOR_BGR2GRAY);
+            } else {
+                gray = guideRows;
+            }
+            for (int y = 0; y < y1 - y0; y++) {
+                const float* a = fullA.ptr<float>(y);
+                const float* b = fullB.ptr<float>(y);
+                const uchar* g = gray.ptr<uchar>(y);
+                uchar* o = out.ptr<uchar>(y0 + y);
+                for (int x = 0; x < guide.cols; x++) {
+                    o[x] = cv::saturate_cast<uchar>(a[x] * g[x] + b[x]);
+                }
+            }
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef BG_REMOVER_IMAGE_INPUT_HPP
+#define BG_REMOVER_IMAGE_INPUT_HPP
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Encoded bytes as a 1-row Mat for cv::imdecode, without copying. Mat sizes
+// are ints, so inputs of 2 GiB or more are rejected rather than truncated.
+inline cv::Mat encodedMat(const uchar* data, size_t size) {
+    if (size > static_cast<size_t>(INT_MAX)) {
+        throw std::runtime_error("Encoded image too large to decode: " + std::to_string(size) + " bytes");
+    }
+    return cv::Mat(1, static_cast<int>(size), CV_8UC1, const_cast<uchar*>(data));
+}
+
+// Encoded image bytes. Files are memory-mapped read-only where the platform
+// allows it, so a large JPEG is decoded straight from the page cache instead
+// of being copied into a buffer first; otherwise the bytes are read.
+class EncodedInput {
+public:
+    EncodedInput() = default;
+
+    // Map or read a whole file. Throws if it can't be opened or read.
+    explicit EncodedInput(const std::string& path) {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file: " + path);
+        }
+        bool isMapped = mapDescriptor(fd);
+        close(fd);
+        if (isMapped) return;
+#endif
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("Could not open file: " + path);
+        }
+        std::streamsize size = file.tellg();
+        file.seekg(0);
+        buffer.resize(static_cast<size_t>(size));
+        if (size > 0 && !file.read(reinterpret_cast<char*>(buffer.data()), size)) {
+            throw std::runtime_error("Could not read file: " + path);
+        }
+    }
+
+    // Take bytes that are already in memory
+    explicit EncodedInput(std::vector<uchar> bytes) : buffer(std::move(bytes)) {}
+
+    EncodedInput(EncodedInput&& other) noexcept { swap(other); }
+    EncodedInput& operator=(EncodedInput&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+    EncodedInput(const EncodedInput&) = delete;
+    EncodedInput& operator=(const EncodedInput&) = delete;
+
+    ~EncodedInput() {
+#ifndef _WIN32
+        if (mapped) munmap(mapped, mappedSize);
+#endif
+    }
+
+    // Map an open descriptor if it refers to a non-empty regular file that
+    // hasn't been read from yet (a file, or stdin redirected from one). The
+    // mapping outlives `fd`.
+    bool mapDescriptor(int fd) {
+#ifndef _WIN32
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0) return false;
+        if (lseek(fd, 0, SEEK_CUR) != 0) return false;
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) return false;
+        // Decoders read front to back
+        madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        mapped = static_cast<uchar*>(address);
+        mappedSize = static_cast<size_t>(info.st_size);
+        return true;
+#else
+        (void)fd;
+        return false;
+#endif
+    }
+
+    const uchar* data() const { return mapped ? mapped : buffer.data(); }
+    size_t size() const { return mapped ? mappedSize : buffer.size(); }
+    bool empty() const { return size() == 0; }
+
+    // The bytes as a 1-row Mat for cv::imdecode (see encodedMat)
+    cv::Mat asMat() const {
+        return encodedMat(data(), size());
+    }
+
+private:
+    uchar* mapped = nullptr;
+    size_t mappedSize = 0;
+    std::vector<uchar> buffer;
+
+    void swap(EncodedInput& other) {
+        std::swap(mapped, other.mapped);
+        std::swap(mappedSize, other.mappedSize);
+        std::swap(buffer, other.buffer);
+    }
+};
+
+inline bool isJpeg(const uchar* data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+inline bool isPng(const uchar* data, size_t size) {
+    static const uchar signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    return size >= 8 && std::equal(signature, signature + 8, data);
+}
+
+inline uint32_t readBigEndian16(const uchar* p) {
+    return (static_cast<uint32_t>(p[0]) << 8) | p[1];
+}
+
+inline uint32_t readBigEndian32(const uchar* p) {
+    return (readBigEndian16(p) << 16) | readBigEndian16(p + 2);
+}
+
+// Walk a JPEG's marker segments up to the start of scan. `visit(marker,
+// payload, length)` returns false to stop early.
+template <typename Visit>
+void forEachJpegSegment(const uchar* data, size_t size, Visit visit) {
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) return;
+        uchar marker = data[pos + 1];
+        if (marker == 0xFF) {  // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) {
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) return;
+        size_t length = readBigEndian16(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size) return;
+        if (!visit(marker, data + pos + 4, length - 2)) return;
+        pos += 2 + length;
+    }
+}
+
+// EXIF orientation (1-8) of a JPEG, or 1 if it has none
+inline int jpegExifOrientation(const uchar* data, size_t size) {
+    int orientation = 1;
+    if (!isJpeg(data, size)) return orientation;
+    forEachJpegSegment(data, size, [&orientation](uchar marker, const uchar* p, size_t length) {
+        if (marker != 0xE1 || length < 14 || std::memcmp(p, "Exif\0\0", 6) != 0) return true;
+        const uchar* tiff = p + 6;
+        size_t tiffSize = length - 6;
+        bool little = tiff[0] == 'I' && tiff[1] == 'I';
+        if (!little && !(tiff[0] == 'M' && tiff[1] == 'M')) return false;
+        auto u16 = [little](const uchar* q) -> uint32_t {
+            return little ? (q[0] | (static_cast<uint32_t>(q[1]) << 8)) : readBigEndian16(q);
+        };
+        auto u32 = [little, &u16](const uchar* q) -> uint32_t {
+            return little ? (u16(q) | (u16(q + 2) << 16)) : readBigEndian32(q);
+        };
+        if (u16(tiff + 2) != 42) return false;
+        size_t ifd = u32(tiff + 4);
+        if (ifd + 2 > tiffSize) return false;
+        size_t count = u16(tiff + ifd);
+        for (size_t i = 0; i < count && ifd + 2 + (i + 1) * 12 <= tiffSize; i++) {
+            const uchar* entry = tiff + ifd + 2 + i * 12;
+            if (u16(entry) == 0x0112) {
+                uint32_t value = u16(entry + 8);
+                if (value >= 1 && value <= 8) orientation = static_cast<int>(value);
+                break;
+            }
+        }
+        return false;
+    });
+    return orientation;
+}
+
+// Width and height from a JPEG or PNG header, as stored (before any EXIF
+// orientation). Returns false for other formats or a truncated header.
+inline bool encodedImageSize(const uchar* data, size_t size, cv::Size& out) {
+    if (isPng(data, size)) {
+        if (size < 24 || std::memcmp(data + 12, "IHDR", 4) != 0) return false;
+        out = cv::Size(static_cast<int>(readBigEndian32(data + 16)), static_cast<int>(readBigEndian32(data + 20)));
+        return out.width > 0 && out.height > 0;
+    }
+    if (!isJpeg(data, size)) return false;
+    bool found = false;
+    forEachJpegSegment(data, size, [&](uchar marker, const uchar* p, size_t length) {
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        bool frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (!frame || length < 5) return true;
+        out = cv::Size(static_cast<int>(readBigEndian16(p + 3)), static_cast<int>(readBigEndian16(p + 1)));
+        found = out.width > 0 && out.height > 0;
+        return false;
+    });
+    return found;
+}
+
+// Size of an image after applying an EXIF orientation
+inline cv::Size orientedSize(cv::Size stored, int orientation) {
+    return orientation >= 5 ? cv::Size(stored.height, stored.width) : stored;
+}
+
+// Apply an EXIF orientation, the same way cv::imread does
+inline void applyExifOrientation(cv::Mat& image, int orientation) {
+    switch (orientation) {
+        case 2: cv::flip(image, image, 1); break;
+        case 3: cv::flip(image, image, -1); break;
+        case 4: cv::flip(image, image, 0); break;
+        case 5: cv::transpose(image, image); break;
+        case 6: cv::transpose(image, image); cv::flip(image, image, 1); break;
+        case 7: cv::transpose(image, image); cv::flip(image, image, -1); break;
+        case 8: cv::transpose(image, image); cv::flip(image, image, 0); break;
+        default: break;
+    }
+}
+
+// Decode to 8-bit BGR, upright. JPEGs can be decoded at 1/2, 1/4 or 1/8 of
+// their size (`reduction`), which libjpeg does while decoding and so costs a
+// fraction of a full decode; other formats ignore it. The EXIF orientation
+// of JPEGs is applied here rather than by OpenCV, so full and reduced
+// decodes are always oriented alike. Returns an empty Mat if decoding fails.
+inline cv::Mat decodeEncodedImage(const uchar* data, size_t size, int reduction = 1) {
+    if (size == 0) return cv::Mat();
+    if (!isJpeg(data, size)) {
+        return cv::imdecode(encodedMat(data, size), cv::IMREAD_COLOR);
+    }
+
+    int flags = cv::IMREAD_COLOR;
+    if (reduction == 2) flags = cv::IMREAD_REDUCED_COLOR_2;
+    if (reduction == 4) flags = cv::IMREAD_REDUCED_COLOR_4;
+    if (reduction == 8) flags = cv::IMREAD_REDUCED_COLOR_8;
+    cv::Mat image = cv::imdecode(encodedMat(data, size), flags | cv::IMREAD_IGNORE_ORIENTATION);
+    if (!image.empty()) {
+        applyExifOrientation(image, jpegExifOrientation(data, size));
+    }
+    return image;
+}
+
+inline cv::Mat decodeEncodedImage(const EncodedInput& input, int reduction = 1) {
+    return decodeEncodedImage(input.data(), input.size(), reduction);
+}
+
+#endif
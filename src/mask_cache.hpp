@@ -0,0 +1,176 @@
+#ifndef BG_REMOVER_MASK_CACHE_HPP
+#define BG_REMOVER_MASK_CACHE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "png_writer.hpp"
+
+// On-disk cache of final alpha masks, one grayscale PNG per entry named
+// <key>.png. Safe to share between processes:
+//  - entries are written to a temporary file and renamed into place, so a
+//    reader never sees a partial mask
+//  - a hit refreshes the entry's modification time, which is the LRU order
+//  - when the directory grows past its limit, the least recently used entries
+//    are deleted until it is under 90% of the limit. One process evicts at a
+//    time (flock on <dir>/.lock); the others skip eviction instead of waiting.
+//  - the directory size is tracked as a running estimate, seeded by one scan
+//    when the cache opens and updated on each store, so a miss costs one
+//    write rather than a directory listing. The directory is rescanned when
+//    the estimate goes over the limit, and every kRescanInterval stores to
+//    pick up entries written by other processes. A scan also removes
+//    temporary files that a crash left behind between write and rename.
+// Failures to read or write the cache never fail the caller; they count as a
+// miss or are ignored. One instance may be used from several threads.
+class MaskCache {
+public:
+    MaskCache(const std::string& dir, size_t maxBytes) : dir(dir), maxBytes(maxBytes) {
+        cv::utils::fs::createDirectories(dir);
+        rescan();
+    }
+
+    // Look up a mask. Returns false on a miss or an unreadable entry.
+    bool load(const std::string& key, cv::Mat& mask) {
+        std::string path = entryPath(key);
+        if (!cv::utils::fs::exists(path)) {
+            misses++;
+            return false;
+        }
+        mask = cv::imread(path, cv::IMREAD_GRAYSCALE);
+        if (mask.empty()) {
+            misses++;
+            return false;
+        }
+        touch(path);
+        hits++;
+        return true;
+    }
+
+    // Add a mask, then evict if the cache is estimated to be over its limit
+    void store(const std::string& key, const cv::Mat& mask) {
+        std::string path = entryPath(key);
+        std::string tempPath = path + ".tmp-" + std::to_string(cv::getTickCount()) + "-" +
+                               std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        try {
+            std::ofstream out(tempPath, std::ios::binary);
+            if (!out) return;
+            // Masks are mostly flat regions, so the fastest level is nearly as small
+            PngStreamWriter writer(out, mask.cols, mask.rows, 1, 1);
+            writer.writeImage(mask);
+            writer.finish();
+            std::streamoff written = out.tellp();
+            out.close();
+            if (!out || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+                std::remove(tempPath.c_str());
+                return;
+            }
+            // Replacing an existing entry overcounts; the next scan corrects it
+            estimatedBytes += written > 0 ? static_cast<size_t>(written) : 0;
+        } catch (const std::exception&) {
+            std::remove(tempPath.c_str());
+            return;
+        }
+        if (estimatedBytes > maxBytes || ++storesSinceScan >= kRescanInterval) rescan();
+    }
+
+    int hitCount() const { return hits; }
+    int missCount() const { return misses; }
+
+private:
+    static const int kRescanInterval = 256;
+    // A temporary file this old belongs to a writer that died before rename
+    static const time_t kStaleTempSeconds = 10 * 60;
+
+    std::string dir;
+    size_t maxBytes;
+    std::atomic<int> hits{0};
+    std::atomic<int> misses{0};
+    std::atomic<size_t> estimatedBytes{0};
+    std::atomic<int> storesSinceScan{0};
+
+    std::string entryPath(const std::string& key) const {
+        return dir + "/" + key + ".png";
+    }
+
+    static void touch(const std::string& path) {
+#ifndef _WIN32
+        utime(path.c_str(), nullptr);
+#endif
+    }
+
+    // Measure the directory, reap stale temporary files and evict if over the
+    // limit. Skipped while another process holds the lock; the estimate then
+    // stays as it is and the next store tries again.
+    void rescan() {
+#ifndef _WIN32
+        int lockFd = open((dir + "/.lock").c_str(), O_RDWR | O_CREAT, 0644);
+        if (lockFd < 0) return;
+        if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+            close(lockFd);
+            return;
+        }
+#endif
+        storesSinceScan = 0;
+        time_t now = time(nullptr);
+        std::vector<cv::String> temps;
+        cv::glob(dir + "/*.tmp-*", temps, false);
+        for (const cv::String& file : temps) {
+            struct stat info;
+            if (stat(file.c_str(), &info) == 0 && now - info.st_mtime > kStaleTempSeconds) {
+                std::remove(file.c_str());
+            }
+        }
+
+        struct Entry {
+            std::string path;
+            size_t size;
+            time_t used;
+        };
+        std::vector<cv::String> files;
+        cv::glob(dir + "/*.png", files, false);
+        std::vector<Entry> entries;
+        size_t total = 0;
+        for (const cv::String& file : files) {
+            struct stat info;
+            if (stat(file.c_str(), &info) != 0) continue;
+            entries.push_back({file, static_cast<size_t>(info.st_size), info.st_mtime});
+            total += info.st_size;
+        }
+
+        if (total > maxBytes) {
+            std::sort(entries.begin(), entries.end(),
+                      [](const Entry& a, const Entry& b) { return a.used < b.used; });
+            size_t target = maxBytes / 10 * 9;
+            for (const Entry& entry : entries) {
+                if (total <= target) break;
+                // Another process may have removed it already
+                std::remove(entry.path.c_str());
+                total -= entry.size;
+            }
+        }
+        estimatedBytes = total;
+#ifndef _WIN32
+        flock(lockFd, LOCK_UN);
+        close(lockFd);
+#endif
+    }
+};
+
+#endif
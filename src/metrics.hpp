@@ -0,0 +1,226 @@
+#ifndef BG_REMOVER_METRICS_HPP
+#define BG_REMOVER_METRICS_HPP
+
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Per-stage wall and CPU time plus facts about the run that explain them
+// (dimensions, kernel sizes, peak memory), written as one JSON object.
+// CPU time is process-wide, so it includes OpenCV and ONNX Runtime worker
+// threads and can exceed wall time.
+class Metrics {
+public:
+    // Add time to a stage. A stage that runs repeatedly (once per strip in
+    // tiled mode) accumulates, and `count` records how often it ran.
+    void addStage(const std::string& name, double wallMs, double cpuMs, int count = 1) {
+        for (Stage& stage : stages) {
+            if (stage.name == name) {
+                stage.wallMs += wallMs;
+                stage.cpuMs += cpuMs;
+                stage.count += count;
+                return;
+            }
+        }
+        stages.push_back({name, wallMs, cpuMs, count});
+    }
+
+    // Record a value. Setting a key again replaces it.
+    void set(const std::string& key, double value) {
+        std::ostringstream out;
+        out.precision(15);
+        out << value;
+        setRaw(key, out.str());
+    }
+
+    void set(const std::string& key, const std::string& value) {
+        setRaw(key, quote(value));
+    }
+
+    void set(const std::string& key, const char* value) {
+        set(key, std::string(value));
+    }
+
+    // Leave cpu_ms out. For runs that share the process with other images'
+    // work (--jobs > 1), process-wide CPU time would count that work too.
+    void omitCpuTimes() {
+        reportCpu = false;
+    }
+
+    // Add another run's stages, e.g. a segmentation shared by a batch group
+    void merge(const Metrics& other) {
+        for (const Stage& stage : other.stages) {
+            addStage(stage.name, stage.wallMs, stage.cpuMs, stage.count);
+        }
+        for (const auto& field : other.fields) {
+            setRaw(field.first, field.second);
+        }
+    }
+
+    // Serialize on one line, so a stream of runs is JSON Lines
+    std::string toJson() const {
+        std::ostringstream out;
+        out.precision(6);
+        out << std::fixed;
+        out << "{";
+        for (const auto& field : fields) {
+            out << quote(field.first) << ":" << field.second << ",";
+        }
+        out << "\"stages\":{";
+        for (size_t i = 0; i < stages.size(); i++) {
+            const Stage& stage = stages[i];
+            if (i > 0) out << ",";
+            out << quote(stage.name) << ":{\"wall_ms\":" << stage.wallMs;
+            if (reportCpu) out << ",\"cpu_ms\":" << stage.cpuMs;
+            if (stage.count > 1) out << ",\"count\":" << stage.count;
+            out << "}";
+        }
+        out << "}}";
+        return out.str();
+    }
+
+private:
+    struct Stage {
+        std::string name;
+        double wallMs;
+        double cpuMs;
+        int count;
+    };
+
+    std::vector<Stage> stages;
+    std::vector<std::pair<std::string, std::string>> fields;  // key -> JSON literal
+    bool reportCpu = true;
+
+    void setRaw(const std::string& key, const std::string& literal) {
+        for (auto& field : fields) {
+            if (field.first == key) {
+                field.second = literal;
+                return;
+            }
+        }
+        fields.push_back({key, literal});
+    }
+
+    static std::string quote(const std::string& value) {
+        std::string out = "\"";
+        for (char c : value) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                    } else {
+                        out += c;
+                    }
+            }
+        }
+        return out + "\"";
+    }
+};
+
+// Times one stage from construction until stop() or destruction. A null
+// Metrics makes it a no-op, so call sites don't need to check.
+class StageTimer {
+public:
+    StageTimer(Metrics* metrics, const char* name)
+        : metrics(metrics), name(name),
+          wallStart(std::chrono::steady_clock::now()), cpuStart(std::clock()) {}
+
+    ~StageTimer() {
+        stop();
+    }
+
+    void stop() {
+        if (!metrics) return;
+        double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+        double cpuMs = (std::clock() - cpuStart) * 1000.0 / CLOCKS_PER_SEC;
+        metrics->addStage(name, wallMs, cpuMs);
+        metrics = nullptr;
+    }
+
+private:
+    Metrics* metrics;
+    const char* name;
+    std::chrono::steady_clock::time_point wallStart;
+    std::clock_t cpuStart;
+};
+
+#ifndef _WIN32
+// Writes to a duplicate of an inherited descriptor (--metrics-json 3). The
+// descriptor is used as the caller opened it: reopening /dev/fd/N would, on
+// Linux, reopen the file with O_TRUNC and wipe what a `3>>metrics.jsonl`
+// redirect has collected. Output is buffered until the stream is flushed,
+// so each endl hands one whole JSON line to write().
+class DescriptorStreamBuf : public std::streambuf {
+public:
+    explicit DescriptorStreamBuf(int fd) : fd(dup(fd)) {}
+
+    ~DescriptorStreamBuf() override {
+        sync();
+        if (fd >= 0) close(fd);
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            pending.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        pending.append(data, static_cast<size_t>(count));
+        return count;
+    }
+
+    int sync() override {
+        size_t written = 0;
+        while (fd >= 0 && written < pending.size()) {
+            ssize_t n = write(fd, pending.data() + written, pending.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            written += static_cast<size_t>(n);
+        }
+        pending.clear();
+        return fd >= 0 ? 0 : -1;
+    }
+
+private:
+    int fd;
+    std::string pending;
+};
+
+class DescriptorStream : public std::ostream {
+public:
+    explicit DescriptorStream(int fd) : std::ostream(nullptr), buffer(fd) {
+        rdbuf(&buffer);
+        if (!buffer.isOpen()) setstate(std::ios::badbit);
+    }
+
+private:
+    DescriptorStreamBuf buffer;
+};
+#endif
+
+#endif
@@ -0,0 +1,2991 @@
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Check if opencv_contrib is available
+#if CV_VERSION_MAJOR >= 3 && __has_include(<opencv2/ximgproc.hpp>)
+#define HAVE_OPENCV_CONTRIB
+#include <opencv2/ximgproc.hpp>
+#endif
+
+#ifdef WITH_ML
+#include <onnxruntime/onnxruntime_cxx_api.h>
+#endif
+
+#include "guided_upsample.hpp"
+#include "image_input.hpp"
+#include "mask_cache.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "png_writer.hpp"
+#include "preprocess.hpp"
+#include "qoi_writer.hpp"
+
+using namespace cv;
+using namespace std;
+
+// Apply quality preset to options
+void applyPreset(ProcessingOptions& opts) {
+    if (opts.quality == "fast") {
+        opts.iterations = 5;
+        opts.edgeMode = "blur";
+        opts.kernelScale = 0.5;
+    } else if (opts.quality == "quality") {
+        opts.iterations = 12;
+        opts.edgeMode = "guided";
+        opts.kernelScale = 1.5;
+    } else if (opts.quality == "multires") {
+        opts.iterations = 8;
+        opts.edgeMode = "guided";
+        opts.kernelScale = 1.0;
+        opts.coarseToFine = true;
+    }
+    // balanced is default (iterations=8, edgeMode="guided", kernelScale=1.0)
+}
+
+// Parse an integer option value, reporting the option name on failure
+int parseIntOption(const string& name, const string& value) {
+    try {
+        size_t used = 0;
+        int result = stoi(value, &used);
+        if (used == value.size()) return result;
+    } catch (const exception&) {
+    }
+    throw invalid_argument("Invalid value for " + name + ": " + value);
+}
+
+// Parse a floating point option value, reporting the option name on failure
+double parseDoubleOption(const string& name, const string& value) {
+    try {
+        size_t used = 0;
+        double result = stod(value, &used);
+        if (used == value.size()) return result;
+    } catch (const exception&) {
+    }
+    throw invalid_argument("Invalid value for " + name + ": " + value);
+}
+
+// Set a named processing option with validation. Shared by the command line
+// and by request options in server mode.
+void setOption(ProcessingOptions& opts, const string& name, const string& value) {
+    if (name == "quality") {
+        if (value != "fast" && value != "balanced" && value != "quality" && value != "multires") {
+            throw invalid_argument("Invalid quality preset. Use: fast, balanced, quality, or multires");
+        }
+        opts.quality = value;
+    } else if (name == "iterations") {
+        opts.iterations = parseIntOption(name, value);
+        if (opts.iterations < 1 || opts.iterations > 20) {
+            throw invalid_argument("Iterations must be between 1 and 20");
+        }
+    } else if (name == "margin") {
+        opts.margin = parseIntOption(name, value);
+        if (opts.margin < 0) {
+            throw invalid_argument("Margin must be >= 0");
+        }
+    } else if (name == "edge-mode") {
+        if (value != "blur" && value != "bilateral" && value != "guided" && value != "fast-guided") {
+            throw invalid_argument("Invalid edge mode. Use: blur, bilateral, guided, or fast-guided");
+        }
+        opts.edgeMode = value;
+    } else if (name == "ml-upsample") {
+        if (value != "linear" && value != "guided") {
+            throw invalid_argument("Invalid ML upsampling. Use: linear or guided");
+        }
+        opts.mlUpsample = value;
+    } else if (name == "adaptive") {
+        if (value != "true" && value != "false") {
+            throw invalid_argument("Invalid value for adaptive. Use: true or false");
+        }
+        opts.adaptive = (value == "true");
+    } else if (name == "convergence") {
+        opts.convergence = parseDoubleOption(name, value);
+        if (opts.convergence <= 0 || opts.convergence >= 1) {
+            throw invalid_argument("Convergence must be between 0 and 1 (exclusive)");
+        }
+        opts.adaptive = true;
+    } else if (name == "mode") {
+        if (value != "ml" && value != "grabcut") {
+            throw invalid_argument("Invalid mode. Use: ml or grabcut");
+        }
+        opts.useML = (value == "ml");
+    } else if (name == "compression") {
+        if (value == "fast") {
+            opts.compression = 1;
+        } else if (value == "default") {
+            opts.compression = 6;
+        } else if (value == "best") {
+            opts.compression = 9;
+        } else {
+            opts.compression = parseIntOption(name, value);
+            if (opts.compression < 0 || opts.compression > 9) {
+                throw invalid_argument("Compression must be 0-9, fast, default, or best");
+            }
+        }
+    } else {
+        throw invalid_argument("Unknown option: " + name);
+    }
+}
+
+bool setBudgetOption(ProcessingOptions& opts, const string& name, const string& value) {
+    int* limit = nullptr;
+    if (name == "max-pixels") {
+        limit = &opts.maxPixels;
+    } else if (name == "max-decoded-mb") {
+        limit = &opts.maxDecodedMB;
+    } else if (name == "memory-ceiling-mb") {
+        limit = &opts.memoryCeilingMB;
+    } else if (name == "deadline-ms") {
+        limit = &opts.deadlineMs;
+    } else if (name == "over-budget") {
+        if (value != "reject" && value != "downscale") {
+            throw invalid_argument("Invalid over-budget action. Use: reject or downscale");
+        }
+        opts.overBudget = value;
+        return true;
+    } else {
+        return false;
+    }
+    *limit = parseIntOption(name, value);
+    if (*limit < 0) {
+        throw invalid_argument("Budget " + name + " must be >= 0 (0 = none)");
+    }
+    return true;
+}
+
+// Start the per-image deadline, unless there is none or it already runs
+void startDeadline(ProcessingOptions& opts) {
+    if (opts.deadlineMs > 0 && opts.deadlineTick == 0) {
+        opts.deadlineTick = getTickCount() + static_cast<int64_t>(opts.deadlineMs * getTickFrequency() / 1000.0);
+    }
+}
+
+bool isOverBudget(const exception& e) {
+    return dynamic_cast<const BudgetExceeded*>(&e) != nullptr;
+}
+
+bool deadlinePassed(const ProcessingOptions& opts) {
+    return opts.deadlineTick != 0 && getTickCount() > opts.deadlineTick;
+}
+
+void checkDeadline(const ProcessingOptions& opts, const string& stage) {
+    if (deadlinePassed(opts)) {
+        throw BudgetExceeded("Deadline of " + to_string(opts.deadlineMs) + " ms exceeded " + stage);
+    }
+}
+
+// Fast non-cryptographic 64-bit hash, used for cache keys. Mixes 8 bytes per
+// step (MurmurHash3-style) so hashing large model files stays cheap.
+uint64_t hashBytes(const void* data, size_t len, uint64_t seed = 0x9e3779b97f4a7c15ULL) {
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ (len * 0xff51afd7ed558ccdULL);
+
+    size_t words = len / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + i * 8, 8);
+        w *= 0x87c37b91114253d5ULL;
+        w = rotl(w, 31);
+        w *= 0x4cf5ad432745937fULL;
+        h ^= w;
+        h = rotl(h, 27) * 5 + 0x52dce729;
+    }
+    for (size_t i = words * 8; i < len; i++) {
+        h ^= p[i] * 0x87c37b91114253d5ULL;
+        h = rotl(h, 31) * 0x4cf5ad432745937fULL;
+    }
+
+    // Final avalanche (splitmix64)
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Format a hash as 16 hex digits
+string hashHex(uint64_t hash) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+    return buf;
+}
+
+// Read a whole file into memory
+vector<char> readFileBytes(const string& path) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file) {
+        throw runtime_error("Could not open file: " + path);
+    }
+    streamsize size = file.tellg();
+    file.seekg(0);
+    vector<char> bytes(size);
+    if (size > 0 && !file.read(bytes.data(), size)) {
+        throw runtime_error("Could not read file: " + path);
+    }
+    return bytes;
+}
+
+// Read an encoded input from file or stdin. Files, and stdin redirected
+// from a file, are memory-mapped instead of copied.
+EncodedInput readInput(const string& path) {
+    if (path != "-") {
+        return EncodedInput(path);
+    }
+    EncodedInput input;
+    #ifndef _WIN32
+    if (input.mapDescriptor(STDIN_FILENO)) return input;
+    #else
+    _setmode(_fileno(stdin), _O_BINARY);
+    #endif
+    vector<uchar> buffer(istreambuf_iterator<char>(cin), {});
+    if (buffer.empty()) {
+        throw runtime_error("No data received from stdin");
+    }
+    return EncodedInput(move(buffer));
+}
+
+// Decode an input read by readInput, upright (see decodeEncodedImage)
+Mat decodeImage(const EncodedInput& input, const string& path, int reduction = 1) {
+    Mat img = decodeEncodedImage(input, reduction);
+    if (img.empty()) {
+        throw runtime_error(path == "-" ? "Could not decode image from stdin"
+                                        : "Could not open or find the image: " + path);
+    }
+    return img;
+}
+
+// Guided upsampling of model masks, at the model's output resolution: a
+// 5x5 window there spans a few percent of the image. The small eps lets the
+// mask edge snap to weak image edges too.
+const int kMLGuideRadius = 2;
+const double kMLGuideEps = 1e-3;
+
+#ifdef WITH_ML
+// Path of a model variant: "u2net.onnx" + "int8" -> "u2net.int8.onnx"
+string modelVariantPath(const string& modelPath, const string& variant) {
+    if (variant.empty()) return modelPath;
+    size_t slash = modelPath.find_last_of("/\\");
+    size_t dot = modelPath.find_last_of('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return modelPath + "." + variant;
+    }
+    return modelPath.substr(0, dot) + "." + variant + modelPath.substr(dot);
+}
+
+struct MLScratch;
+
+// Loaded ONNX model. Building the session (deserialization and graph
+// optimization) is the expensive part, so it is created once and shared by
+// every image processed in this process.
+struct MLModel {
+    Ort::Env env;
+    Ort::Session session;
+    string inputName;
+    string outputName;
+    int64_t batchSize = 1;        // Images per inference (capacity for dynamic-batch models)
+    bool dynamicBatch = false;    // Model accepts any batch size
+    int64_t channels = 3;
+    int64_t inputHeight = 320;
+    int64_t inputWidth = 320;
+    vector<int64_t> outputShape;  // As declared by the model; may contain -1
+    TensorNormalization norm;
+    uint64_t modelHash = 0;       // Hash of the model file bytes
+
+    // Per-thread inference buffers. Declared after the session so they are
+    // released before it. With `sharedScratch`, every thread uses one entry.
+    mutex scratchMutex;
+    map<thread::id, unique_ptr<MLScratch>> scratchByThread;
+    bool sharedScratch = false;
+
+    MLModel(const ProcessingOptions& opts, bool verbose)
+        : env(ORT_LOGGING_LEVEL_WARNING, "bg-remover"), session(nullptr) {
+        normalizationPreset(opts.modelNorm, norm);
+
+        try {
+            string modelPath = modelVariantPath(opts.modelPath, opts.modelVariant);
+            if (!utils::fs::exists(modelPath)) {
+                if (opts.modelVariant.empty()) {
+                    throw runtime_error("Model file not found: " + modelPath);
+                }
+                throw runtime_error("Model variant not found: " + modelPath +
+                                    " (create it with scripts/quantize-model.py)");
+            }
+
+            if (verbose) {
+                cerr << "Loading ML model: " << modelPath << endl;
+            }
+            int64 start = getTickCount();
+            loadSession(modelPath, opts, verbose);
+            if (verbose) {
+                double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+                cerr << "Model loaded in " << ms << " ms" << endl;
+            }
+
+            Ort::AllocatorWithDefaultOptions allocator;
+
+            // Query input metadata from model
+            if (session.GetInputCount() == 0) {
+                throw runtime_error("Model has no input nodes");
+            }
+
+            // Get first input name
+            Ort::AllocatedStringPtr input_name_ptr = session.GetInputNameAllocated(0, allocator);
+            inputName = input_name_ptr.get();
+
+            // Get input shape
+            Ort::TypeInfo input_type_info = session.GetInputTypeInfo(0);
+            auto input_tensor_info = input_type_info.GetTensorTypeAndShapeInfo();
+            vector<int64_t> input_shape_vec = input_tensor_info.GetShape();
+
+            if (verbose) {
+                cerr << "Model input name: " << inputName << endl;
+                cerr << "Model input shape: [";
+                for (size_t i = 0; i < input_shape_vec.size(); i++) {
+                    cerr << input_shape_vec[i];
+                    if (i < input_shape_vec.size() - 1) cerr << ", ";
+                }
+                cerr << "]" << endl;
+            }
+
+            // Handle dynamic dimensions (-1 in shape) - use common defaults.
+            // A dynamic batch dimension lets us stack up to mlBatchSize images.
+            if (input_shape_vec.size() > 0 && input_shape_vec[0] > 0) {
+                batchSize = input_shape_vec[0];
+            } else {
+                dynamicBatch = true;
+                batchSize = opts.mlBatchSize;
+            }
+            if (input_shape_vec.size() > 1 && input_shape_vec[1] > 0) channels = input_shape_vec[1];
+            if (input_shape_vec.size() > 2 && input_shape_vec[2] > 0) inputHeight = input_shape_vec[2];
+            if (input_shape_vec.size() > 3 && input_shape_vec[3] > 0) inputWidth = input_shape_vec[3];
+
+            if (channels != 3) {
+                throw runtime_error("Model expects " + to_string(channels) + " input channels; only 3 are supported");
+            }
+
+            if (verbose) {
+                cerr << "Using input dimensions: " << batchSize << (dynamicBatch ? " (dynamic)" : "") << "x"
+                     << channels << "x" << inputHeight << "x" << inputWidth << endl;
+            }
+
+            // Query output metadata from model
+            if (session.GetOutputCount() == 0) {
+                throw runtime_error("Model has no output nodes");
+            }
+
+            // Get first output name and declared shape
+            Ort::AllocatedStringPtr output_name_ptr = session.GetOutputNameAllocated(0, allocator);
+            outputName = output_name_ptr.get();
+            outputShape = session.GetOutputTypeInfo(0).GetTensorTypeAndShapeInfo().GetShape();
+
+            if (verbose) {
+                cerr << "Model output name: " << outputName << endl;
+            }
+        } catch (const Ort::Exception& e) {
+            throw runtime_error(string("ONNX Runtime error: ") + e.what());
+        }
+    }
+
+    MLScratch& scratch();
+    void warmup(bool verbose);
+
+private:
+    Ort::SessionOptions sessionOptions(const ProcessingOptions& opts) {
+        Ort::SessionOptions session_options;
+        session_options.SetIntraOpNumThreads(opts.intraOpThreads);
+        if (opts.interOpThreads > 0) {
+            session_options.SetInterOpNumThreads(opts.interOpThreads);
+        }
+        session_options.SetExecutionMode(opts.parallelExecution ? ORT_PARALLEL : ORT_SEQUENTIAL);
+        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+        return session_options;
+    }
+
+    // Create the session, using a cached pre-optimized graph when available.
+    // The cache sits next to the model as <model>.opt-<key>.onnx. The key
+    // covers the model bytes and the ORT version, so a changed model or
+    // runtime never picks up a stale graph. The first load writes the graph
+    // to a temporary file and renames it into place, so concurrent processes
+    // never see a partial file. Caching is skipped if the directory is not
+    // writable.
+    void loadSession(const string& modelPath, const ProcessingOptions& opts, bool verbose) {
+        vector<char> modelBytes = readFileBytes(modelPath);
+        modelHash = hashBytes(modelBytes.data(), modelBytes.size());
+
+        if (!opts.modelCache) {
+            session = Ort::Session(env, modelBytes.data(), modelBytes.size(), sessionOptions(opts));
+            return;
+        }
+
+        string ortVersion = OrtGetApiBase()->GetVersionString();
+        uint64_t key = hashBytes(ortVersion.data(), ortVersion.size(), modelHash);
+        string cachePath = modelPath + ".opt-" + hashHex(key) + ".onnx";
+
+        if (utils::fs::exists(cachePath)) {
+            try {
+                // Already optimized; running the optimizer again would be wasted work
+                Ort::SessionOptions session_options = sessionOptions(opts);
+                session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+                session = Ort::Session(env, cachePath.c_str(), session_options);
+                if (verbose) {
+                    cerr << "Using optimized graph cache: " << cachePath << endl;
+                }
+                return;
+            } catch (const Ort::Exception& e) {
+                if (verbose) {
+                    cerr << "Ignoring unreadable graph cache " << cachePath << ": " << e.what() << endl;
+                }
+                remove(cachePath.c_str());
+            }
+        }
+
+        string tempPath = cachePath + ".tmp-" + to_string(getTickCount());
+        try {
+            Ort::SessionOptions session_options = sessionOptions(opts);
+            session_options.SetOptimizedModelFilePath(tempPath.c_str());
+            session = Ort::Session(env, modelBytes.data(), modelBytes.size(), session_options);
+        } catch (const Ort::Exception& e) {
+            // Most likely the directory is not writable; load without caching
+            remove(tempPath.c_str());
+            if (verbose) {
+                cerr << "Could not write graph cache (" << e.what() << "), continuing without it" << endl;
+            }
+            session = Ort::Session(env, modelBytes.data(), modelBytes.size(), sessionOptions(opts));
+            return;
+        }
+
+        if (rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+            remove(tempPath.c_str());
+        } else if (verbose) {
+            cerr << "Wrote optimized graph cache: " << cachePath << endl;
+        }
+    }
+};
+
+// Inference buffers for one thread, sized for a full batch. The input buffer
+// is allocated once. Each run wraps it in a tensor for the actual batch size
+// and binds it with IoBinding. Models with a fully static output shape get a
+// preallocated, bound output tensor too. Otherwise ORT allocates the output
+// on each run.
+struct MLScratch {
+    vector<float> input;
+    vector<float> output;
+    Mat resized;
+    vector<Mat> planes;
+    Mat smallMask;
+    Ort::Value inputTensor;
+    Ort::Value outputTensor;
+    Ort::IoBinding binding;
+    bool outputBound = false;
+
+    explicit MLScratch(MLModel& model)
+        : inputTensor(nullptr), outputTensor(nullptr), binding(model.session) {
+        input.assign(model.batchSize * model.channels * model.inputHeight * model.inputWidth, 0.0f);
+
+        int64_t output_size = 1;
+        for (int64_t dim : model.outputShape) {
+            if (dim <= 0) {
+                output_size = -1;
+                break;
+            }
+            output_size *= dim;
+        }
+
+        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        if (output_size > 0 && !model.outputShape.empty()) {
+            output.assign(output_size, 0.0f);
+            outputTensor = Ort::Value::CreateTensor<float>(
+                memory_info, output.data(), output.size(), model.outputShape.data(), model.outputShape.size());
+            binding.BindOutput(model.outputName.c_str(), outputTensor);
+            outputBound = true;
+        } else {
+            binding.BindOutput(model.outputName.c_str(), memory_info);
+        }
+    }
+
+    // Bind the first `count` images of the input buffer (the whole buffer for
+    // static-batch models, which always run at their declared batch size)
+    void bindInput(MLModel& model, int64_t count) {
+        int64_t batch = model.dynamicBatch ? count : model.batchSize;
+        vector<int64_t> input_shape = {batch, model.channels, model.inputHeight, model.inputWidth};
+        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        inputTensor = Ort::Value::CreateTensor<float>(
+            memory_info, input.data(), batch * model.channels * model.inputHeight * model.inputWidth,
+            input_shape.data(), input_shape.size());
+        binding.BindInput(model.inputName.c_str(), inputTensor);
+    }
+};
+
+MLScratch& MLModel::scratch() {
+    lock_guard<mutex> lock(scratchMutex);
+    unique_ptr<MLScratch>& entry = scratchByThread[sharedScratch ? thread::id() : this_thread::get_id()];
+    if (!entry) {
+        entry.reset(new MLScratch(*this));
+    }
+    return *entry;
+}
+
+// Run ML-based segmentation on up to model.batchSize images stacked into one
+// [N,3,H,W] tensor. Returns one 8-bit mask per image, at that image's size.
+// With `guidedUpsample`, the model-resolution mask is upsampled with the
+// image as a guide (fastGuidedFilter), so edges follow the image instead of
+// the model's coarse grid; otherwise it is resized bilinearly.
+vector<Mat> runMLSegmentationBatch(const vector<Mat>& images, MLModel& model, bool guidedUpsample, bool verbose,
+                                   Metrics* metrics = nullptr) {
+    if (images.empty()) return vector<Mat>();
+    if (static_cast<int64_t>(images.size()) > model.batchSize) {
+        throw runtime_error("Batch of " + to_string(images.size()) + " images exceeds model batch size " +
+                            to_string(model.batchSize));
+    }
+
+    try {
+        MLScratch& scratch = model.scratch();
+
+        // Preprocess: resize, normalize and lay out as NCHW directly in the input buffer
+        StageTimer preprocessTimer(metrics, "ml_preprocess");
+        size_t image_size = model.channels * model.inputHeight * model.inputWidth;
+        for (size_t i = 0; i < images.size(); i++) {
+            fillTensorNCHW(images[i], Size(model.inputWidth, model.inputHeight), model.norm,
+                           scratch.input.data() + i * image_size, scratch.resized, scratch.planes);
+        }
+        scratch.bindInput(model, images.size());
+        preprocessTimer.stop();
+
+        if (verbose) {
+            cerr << "Running ML inference on " << images.size() << " image(s)..." << endl;
+        }
+
+        // Run inference
+        StageTimer inferenceTimer(metrics, "ml_inference");
+        model.session.Run(Ort::RunOptions{nullptr}, scratch.binding);
+        inferenceTimer.stop();
+
+        // Get output tensor (preallocated, or allocated by ORT for dynamic shapes)
+        vector<Ort::Value> dynamic_outputs;
+        Ort::Value* output = &scratch.outputTensor;
+        if (!scratch.outputBound) {
+            dynamic_outputs = scratch.binding.GetOutputValues();
+            output = &dynamic_outputs[0];
+        }
+        float* output_data = output->GetTensorMutableData<float>();
+        auto output_shape = output->GetTensorTypeAndShapeInfo().GetShape();
+
+        if (verbose) {
+            cerr << "Output shape: [";
+            for (size_t i = 0; i < output_shape.size(); i++) {
+                cerr << output_shape[i];
+                if (i < output_shape.size() - 1) cerr << ", ";
+            }
+            cerr << "]" << endl;
+        }
+
+        // Handle different output formats. Each image's mask starts `stride`
+        // floats after the previous one.
+        int64_t out_height, out_width, stride;
+        if (output_shape.size() == 4) {
+            // Format: [batch, channels, height, width] - extract first channel
+            out_height = output_shape[2];
+            out_width = output_shape[3];
+            stride = output_shape[1] * out_height * out_width;
+        } else if (output_shape.size() == 3) {
+            // Format: [batch, height, width]
+            out_height = output_shape[1];
+            out_width = output_shape[2];
+            stride = out_height * out_width;
+        } else if (output_shape.size() == 2 && images.size() == 1) {
+            // Format: [height, width]
+            out_height = output_shape[0];
+            out_width = output_shape[1];
+            stride = 0;
+        } else {
+            throw runtime_error("Unsupported output shape with " + to_string(output_shape.size()) + " dimensions");
+        }
+
+        // Quantize and resize each mask back to its image's original size
+        StageTimer postprocessTimer(metrics, "ml_postprocess");
+        vector<Mat> masks(images.size());
+        for (size_t i = 0; i < images.size(); i++) {
+            Mat prob(out_height, out_width, CV_32F, output_data + i * stride);
+            if (guidedUpsample) {
+                prob.convertTo(scratch.smallMask, CV_8U, 255.0);
+                fastGuidedFilter(images[i], scratch.smallMask, masks[i], kMLGuideRadius, kMLGuideEps,
+                                 scratch.smallMask.size());
+            } else {
+                tensorToMask(prob, images[i].size(), scratch.smallMask, masks[i]);
+            }
+        }
+        postprocessTimer.stop();
+
+        if (verbose) {
+            cerr << "ML inference completed" << endl;
+        }
+
+        return masks;
+
+    } catch (const Ort::Exception& e) {
+        throw runtime_error(string("ONNX Runtime error: ") + e.what());
+    }
+}
+
+// Run ML-based segmentation on a single image
+Mat runMLSegmentation(const Mat& image, MLModel& model, bool guidedUpsample, bool verbose,
+                      Metrics* metrics = nullptr) {
+    return runMLSegmentationBatch(vector<Mat>(1, image), model, guidedUpsample, verbose, metrics)[0];
+}
+
+// Run one inference on a blank image so ORT's lazy initialization (arena
+// allocation, kernel setup) happens now rather than on the first real request
+void MLModel::warmup(bool verbose) {
+    int64 start = getTickCount();
+    runMLSegmentation(Mat::zeros(static_cast<int>(inputHeight), static_cast<int>(inputWidth), CV_8UC3), *this,
+                      false, false);
+    if (verbose) {
+        double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        cerr << "Warmup inference: " << ms << " ms" << endl;
+    }
+}
+
+// Images that can share one inference call
+shared_ptr<MLModel> loadModel(const ProcessingOptions& opts, bool verbose) {
+    return make_shared<MLModel>(opts, verbose);
+}
+
+void warmupModel(MLModel& model, bool verbose) {
+    model.warmup(verbose);
+}
+
+void shareModelScratch(MLModel& model) {
+    lock_guard<mutex> lock(model.scratchMutex);
+    model.sharedScratch = true;
+}
+
+int mlBatchCapacity(const MLModel* model) {
+    return model ? static_cast<int>(model->batchSize) : 1;
+}
+
+uint64_t mlModelHash(const MLModel* model) {
+    return model ? model->modelHash : 0;
+}
+
+Size mlInputSize(const MLModel* model) {
+    return model ? Size(static_cast<int>(model->inputWidth), static_cast<int>(model->inputHeight)) : Size();
+}
+#else
+// Placeholder so pipeline signatures are identical with and without ML support
+struct MLModel {};
+
+int mlBatchCapacity(const MLModel*) {
+    return 1;
+}
+
+uint64_t mlModelHash(const MLModel*) {
+    return 0;
+}
+
+Size mlInputSize(const MLModel*) {
+    return Size();
+}
+#endif
+
+// Run GrabCut one iteration at a time, checking the deadline in between. In
+// adaptive mode, stop once the fraction of pixels that switched between
+// foreground and background falls below the convergence threshold. The GMMs
+// persist in bgModel/fgModel between steps, so this matches a single call with
+// the same iteration count when it runs to the end. Returns the number of
+// iterations used.
+int grabCutStepwise(const Mat& image, Mat& labels, const Rect& rect, Mat& bgModel, Mat& fgModel,
+                    const ProcessingOptions& opts, int mode) {
+    checkDeadline(opts, "before GrabCut");
+    grabCut(image, labels, rect, bgModel, fgModel, 1, mode);
+
+    double limit = opts.convergence * image.total();
+    Mat previous;
+    if (opts.adaptive) previous = (labels == GC_FGD) | (labels == GC_PR_FGD);
+    Mat current, changed;
+    int used = 1;
+    while (used < opts.iterations) {
+        checkDeadline(opts, "after " + to_string(used) + " GrabCut iterations");
+        grabCut(image, labels, rect, bgModel, fgModel, 1, GC_EVAL);
+        used++;
+        if (!opts.adaptive) continue;
+
+        current = (labels == GC_FGD) | (labels == GC_PR_FGD);
+        compare(current, previous, changed, CMP_NE);
+        if (countNonZero(changed) < limit) break;
+        swap(previous, current);
+    }
+    return used;
+}
+
+// Run the configured number of GrabCut iterations, or fewer in adaptive mode.
+// Returns the number of iterations used.
+int runGrabCut(const Mat& image, Mat& labels, const Rect& rect, Mat& bgModel, Mat& fgModel,
+               const ProcessingOptions& opts, int mode) {
+    if (opts.adaptive || opts.deadlineTick != 0) {
+        return grabCutStepwise(image, labels, rect, bgModel, fgModel, opts, mode);
+    }
+    grabCut(image, labels, rect, bgModel, fgModel, opts.iterations, mode);
+    return opts.iterations;
+}
+
+// GrabCut's initial rectangle: the image inset by the margin
+Rect grabCutRect(Size size, const ProcessingOptions& opts) {
+    int inset_x, inset_y;
+    if (opts.margin >= 0) {
+        // Use user-specified margin
+        inset_x = opts.margin;
+        inset_y = opts.margin;
+    } else {
+        // Proportional inset: 2% of dimensions or minimum 5px
+        inset_x = max(5, size.width / 50);
+        inset_y = max(5, size.height / 50);
+    }
+    return Rect(inset_x, inset_y, size.width - 2*inset_x, size.height - 2*inset_y);
+}
+
+// Morphology kernel size based on image dimensions and scale factor
+int morphologyKernelSize(Size size, const ProcessingOptions& opts) {
+    int base_dim = min(size.width, size.height);
+    int kernel_size = max(3, min(15, static_cast<int>((base_dim / 150) * opts.kernelScale)));
+    if (kernel_size % 2 == 0) kernel_size++;  // Must be odd
+    return kernel_size;
+}
+
+// Run GrabCut on a copy downscaled by `scale` and return its binary (0/255)
+// foreground at the reduced size
+Mat coarseGrabCut(const Mat& image, const Rect& rectangle, double scale, const ProcessingOptions& opts, bool showVerbose) {
+    int64 start = getTickCount();
+    Mat small;
+    resize(image, small, Size(), scale, scale, INTER_AREA);
+    Rect smallRect(cvRound(rectangle.x * scale), cvRound(rectangle.y * scale),
+                   cvRound(rectangle.width * scale), cvRound(rectangle.height * scale));
+    smallRect &= Rect(0, 0, small.cols, small.rows);
+
+    Mat smallLabels = Mat::zeros(small.size(), CV_8UC1);
+    Mat bgModel, fgModel;
+    int used = runGrabCut(small, smallLabels, smallRect, bgModel, fgModel, opts, GC_INIT_WITH_RECT);
+
+    if (showVerbose) {
+        double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        cout << "  Coarse GrabCut at " << small.cols << "x" << small.rows << ": " << ms << " ms";
+        if (opts.adaptive) cout << " (" << used << " of " << opts.iterations << " iterations)";
+        cout << endl;
+    }
+
+    return (smallLabels == GC_FGD) | (smallLabels == GC_PR_FGD);
+}
+
+// Band half-width that covers the uncertainty of a mask upsampled from
+// `scale`. One coarse pixel spans 1/scale full-resolution pixels.
+int boundaryBandWidth(double scale) {
+    return max(4, cvCeil(2.0 / scale));
+}
+
+// Refine an upsampled binary foreground with full-resolution GrabCut
+// iterations restricted to the band along its contour. Pixels more than
+// `band` pixels inside or outside the contour are pinned to GC_FGD/GC_BGD.
+// Returns GrabCut labels for `image`.
+Mat refineBoundaryBand(const Mat& image, const Mat& fg, const Rect& rectangle, int band,
+                       const ProcessingOptions& opts, bool showVerbose) {
+    int64 start = getTickCount();
+    Mat bandKernel = getStructuringElement(MORPH_ELLIPSE, Size(2 * band + 1, 2 * band + 1));
+    Mat inner, outer;
+    erode(fg, inner, bandKernel);
+    dilate(fg, outer, bandKernel);
+
+    // Pinned exterior (GC_BGD), probable labels in the band, pinned interior (GC_FGD).
+    // Anything outside the user rectangle stays background, as with GC_INIT_WITH_RECT.
+    Mat labels = Mat::zeros(image.size(), CV_8UC1);
+    Mat seeded = Mat::zeros(image.size(), CV_8UC1);
+    seeded.setTo(GC_PR_BGD, outer);
+    seeded.setTo(GC_PR_FGD, fg);
+    seeded.setTo(GC_FGD, inner);
+    seeded(rectangle).copyTo(labels(rectangle));
+
+    // Only tiles that touch the band are refined. Each tile reads a margin of
+    // context from the seeded labels and writes back its core only, so tiles
+    // are independent and can run in parallel.
+    Mat bandMask = outer - inner;
+    Rect bounds(0, 0, image.cols, image.rows);
+    int tileSize = max(128, band * 16);
+    vector<Rect> tiles;
+    for (int y = 0; y < image.rows; y += tileSize) {
+        for (int x = 0; x < image.cols; x += tileSize) {
+            Rect core = Rect(x, y, tileSize, tileSize) & bounds;
+            if (countNonZero(bandMask(core)) > 0) {
+                tiles.push_back(core);
+            }
+        }
+    }
+
+    Mat initial = labels.clone();
+    parallel_for_(Range(0, static_cast<int>(tiles.size())), [&](const Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            // Past the deadline, skip the remaining tiles; reported below
+            if (deadlinePassed(opts)) break;
+            const Rect& core = tiles[i];
+            Rect roi = Rect(core.x - band, core.y - band, core.width + 2 * band, core.height + 2 * band) & bounds;
+            Mat tileLabels = initial(roi).clone();
+
+            // GrabCut fits a 5-component GMM to each side and needs samples of both
+            int fgCount = countNonZero((tileLabels == GC_FGD) | (tileLabels == GC_PR_FGD));
+            if (fgCount < 64 || roi.area() - fgCount < 64) continue;
+
+            Mat tileBg, tileFg;
+            grabCut(image(roi), tileLabels, Rect(), tileBg, tileFg, opts.refineIterations, GC_INIT_WITH_MASK);
+
+            Rect local(core.x - roi.x, core.y - roi.y, core.width, core.height);
+            tileLabels(local).copyTo(labels(core));
+        }
+    });
+
+    checkDeadline(opts, "during boundary refinement");
+
+    if (showVerbose) {
+        double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+        cout << "  Boundary refinement: " << tiles.size() << " tiles, " << band << "px band: " << ms << " ms" << endl;
+    }
+
+    return labels;
+}
+
+// Coarse-to-fine GrabCut for large images. Runs the full iteration count on a
+// downscaled copy, upsamples the result, then runs a few full-resolution
+// iterations only in tiles along the boundary. Returns GrabCut labels.
+Mat grabCutCoarseToFine(const Mat& image, const Rect& rectangle, const ProcessingOptions& opts, bool showVerbose) {
+    double scale = static_cast<double>(opts.coarseMaxDim) / max(image.cols, image.rows);
+    if (scale >= 1.0) {
+        // Already small enough, a plain pass is just as fast
+        Mat labels = Mat::zeros(image.size(), CV_8UC1);
+        Mat bgModel, fgModel;
+        int used = runGrabCut(image, labels, rectangle, bgModel, fgModel, opts, GC_INIT_WITH_RECT);
+        if (showVerbose && opts.adaptive) {
+            cout << "  GrabCut iterations used: " << used << " of " << opts.iterations << endl;
+        }
+        return labels;
+    }
+
+    Mat smallFg = coarseGrabCut(image, rectangle, scale, opts, showVerbose);
+
+    // Upsample the coarse foreground and refine the band around its contour
+    Mat fg;
+    resize(smallFg, fg, image.size(), 0, 0, INTER_LINEAR);
+    threshold(fg, fg, 127, 255, THRESH_BINARY);
+
+    return refineBoundaryBand(image, fg, rectangle, boundaryBandWidth(scale), opts, showVerbose);
+}
+
+// Downscale factor of the "fast-guided" edge mode's working resolution
+const int kFastGuidedFactor = 4;
+
+// Apply `filter` only where it can change `mask`. The filters used on masks
+// (morphology, box, Gaussian, bilateral and guided filters) map a region
+// that is constant for `reach` pixels around a pixel to that same constant,
+// so only the band where the dilated and eroded mask differ can change.
+// Tiles that touch the band are filtered with `reach` pixels of context, and
+// only band pixels are written back: interior and exterior keep their exact
+// values, and the cost follows the contour length rather than the image area.
+// `filter(imageTile, maskTile)` updates a copy of the mask tile in place.
+// Returns the number of tiles filtered.
+template <typename Filter>
+int filterMaskBand(const Mat& image, Mat& mask, int reach, Filter filter) {
+    Mat bandKernel = getStructuringElement(MORPH_RECT, Size(2 * reach + 1, 2 * reach + 1));
+    Mat outer, inner, band;
+    dilate(mask, outer, bandKernel);
+    erode(mask, inner, bandKernel);
+    compare(outer, inner, band, CMP_GT);
+    outer.release();
+    inner.release();
+
+    Rect bounds(0, 0, mask.cols, mask.rows);
+    int tileSize = max(128, reach * 8);
+    vector<Rect> tiles;
+    for (int y = 0; y < mask.rows; y += tileSize) {
+        for (int x = 0; x < mask.cols; x += tileSize) {
+            Rect core = Rect(x, y, tileSize, tileSize) & bounds;
+            if (countNonZero(band(core)) > 0) {
+                tiles.push_back(core);
+            }
+        }
+    }
+    if (tiles.empty()) return 0;
+
+    // Tiles read their context from the unfiltered mask and write disjoint cores
+    Mat source = mask.clone();
+    parallel_for_(Range(0, static_cast<int>(tiles.size())), [&](const Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            const Rect& core = tiles[i];
+            Rect roi = Rect(core.x - reach, core.y - reach, core.width + 2 * reach, core.height + 2 * reach) & bounds;
+            Mat tile = source(roi).clone();
+            filter(image(roi), tile);
+
+            Rect local(core.x - roi.x, core.y - roi.y, core.width, core.height);
+            tile(local).copyTo(mask(core), band(core));
+        }
+    });
+    return static_cast<int>(tiles.size());
+}
+
+// Bilateral filter on an 8-bit mask, in float as before; a 9px diameter
+// reaches 4px
+const int kBilateralReach = 4;
+
+void bilateralMask(Mat& mask) {
+    Mat mask_float, filtered;
+    mask.convertTo(mask_float, CV_32F);
+    bilateralFilter(mask_float, filtered, 2 * kBilateralReach + 1, 75, 75);
+    filtered.convertTo(mask, CV_8UC1);
+}
+
+// Clean up a binary GrabCut mask with morphology, then soften its edges with
+// the selected edge mode. Works on any image/mask pair of the same size, so
+// it can run on strips of a larger image. Both steps only touch the band
+// along the mask's contour (see filterMaskBand).
+void refineMask(const Mat& image, Mat& mask2, int kernel_size, const ProcessingOptions& opts, Metrics* metrics = nullptr) {
+    // Apply morphological operations to clean up mask. Close then open reads
+    // up to two kernel radii away each.
+    StageTimer morphologyTimer(metrics, "morphology");
+    Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(kernel_size, kernel_size));
+    filterMaskBand(image, mask2, 4 * (kernel_size / 2), [&kernel](const Mat&, Mat& tile) {
+        morphologyEx(tile, tile, MORPH_CLOSE, kernel);
+        morphologyEx(tile, tile, MORPH_OPEN, kernel);
+    });
+    morphologyTimer.stop();
+    if (metrics) metrics->set("morphology_kernel", kernel_size);
+
+    // Apply edge refinement based on selected mode
+    StageTimer edgeTimer(metrics, "edge_refinement");
+    int tiles = 0;
+    if (opts.edgeMode == "guided") {
+#ifdef HAVE_OPENCV_CONTRIB
+        // Edge-preserving guided filter for best boundary quality. Its two
+        // box filter passes read up to twice the radius away.
+        int guide_radius = max(4, kernel_size);
+        double eps = 0.01;
+        if (metrics) metrics->set("guide_radius", guide_radius);
+
+        tiles = filterMaskBand(image, mask2, 2 * guide_radius, [&](const Mat& imageTile, Mat& tile) {
+            Mat mask_float, image_gray, image_gray_float;
+            tile.convertTo(mask_float, CV_32F, 1.0/255.0);
+
+            cvtColor(imageTile, image_gray, COLOR_BGR2GRAY);
+            image_gray.convertTo(image_gray_float, CV_32F, 1.0/255.0);
+
+            Mat refined;
+            ximgproc::guidedFilter(image_gray_float, mask_float, refined, guide_radius, eps);
+            refined.convertTo(tile, CV_8UC1, 255.0);
+        });
+#else
+        // Fallback to bilateral filter if opencv_contrib not available
+        tiles = filterMaskBand(image, mask2, kBilateralReach, [](const Mat&, Mat& tile) { bilateralMask(tile); });
+#endif
+    } else if (opts.edgeMode == "fast-guided") {
+        // Guided filter fitted at quarter resolution and applied at full
+        // resolution, with the same full-resolution radius as "guided". The
+        // extra reach covers the coefficient upsampling.
+        int guide_radius = max(4, kernel_size);
+        int work_radius = max(1, guide_radius / kFastGuidedFactor);
+        if (metrics) metrics->set("guide_radius", guide_radius);
+
+        int reach = (2 * work_radius + 2) * kFastGuidedFactor;
+        tiles = filterMaskBand(image, mask2, reach, [work_radius](const Mat& imageTile, Mat& tile) {
+            Size work(max(1, tile.cols / kFastGuidedFactor), max(1, tile.rows / kFastGuidedFactor));
+            fastGuidedFilter(imageTile, tile, tile, work_radius, 0.01, work);
+        });
+    } else if (opts.edgeMode == "bilateral") {
+        // Bilateral filter for edge-preserving smoothing
+        tiles = filterMaskBand(image, mask2, kBilateralReach, [](const Mat&, Mat& tile) { bilateralMask(tile); });
+    } else {
+        // Simple Gaussian blur (fast mode)
+        int blur_size = max(5, kernel_size * 2 + 1);
+        if (blur_size % 2 == 0) blur_size++;
+        double sigma = blur_size / 4.0;
+        tiles = filterMaskBand(image, mask2, blur_size / 2, [blur_size, sigma](const Mat&, Mat& tile) {
+            GaussianBlur(tile, tile, Size(blur_size, blur_size), sigma);
+        });
+        if (metrics) metrics->set("blur_kernel", blur_size);
+    }
+    if (metrics) metrics->set("edge_tiles", tiles);
+}
+
+// Print the options that affect segmentation
+void printProcessingOptions(const ProcessingOptions& opts) {
+    cout << "Processing options:" << endl;
+    cout << "  Mode: " << (opts.useML ? "ML" : "GrabCut") << endl;
+    if (!opts.useML) {
+        cout << "  Quality: " << opts.quality << endl;
+        cout << "  Iterations: " << opts.iterations;
+        if (opts.adaptive) cout << " max (adaptive, convergence " << opts.convergence << ")";
+        cout << endl;
+        cout << "  Edge mode: " << opts.edgeMode << endl;
+        cout << "  Kernel scale: " << opts.kernelScale << endl;
+        if (opts.coarseToFine) {
+            cout << "  Coarse-to-fine: " << opts.coarseMaxDim << "px coarse, "
+                 << opts.refineIterations << " refine iterations" << endl;
+        }
+    } else {
+        cout << "  Mask upsampling: " << opts.mlUpsample << endl;
+    }
+}
+
+// Segment a decoded image. Returns the ML alpha mask, or GrabCut's binary
+// mask before morphology and edge refinement (see refineSegmentation).
+Mat segmentImage(const Mat& image, const ProcessingOptions& opts, MLModel* model, bool showVerbose,
+                 Metrics* metrics = nullptr) {
+    Mat mask2;
+
+#ifdef WITH_ML
+    if (opts.useML) {
+        // Use ML-based segmentation with the already loaded model
+        mask2 = runMLSegmentation(image, *model, opts.mlUpsample == "guided", showVerbose, metrics);
+    } else
+#endif
+    {
+        // Use traditional GrabCut algorithm for background removal
+        Mat mask = Mat::zeros(image.size(), CV_8UC1);
+        Rect rectangle = grabCutRect(image.size(), opts);
+        Mat bgModel, fgModel;
+
+        if (showVerbose) {
+            cout << "Processing image with GrabCut algorithm..." << endl;
+        }
+
+        // Run GrabCut
+        StageTimer grabCutTimer(metrics, "grabcut");
+        if (opts.coarseToFine) {
+            mask = grabCutCoarseToFine(image, rectangle, opts, showVerbose);
+        } else {
+            int used = runGrabCut(image, mask, rectangle, bgModel, fgModel, opts, GC_INIT_WITH_RECT);
+            if (showVerbose && opts.adaptive) {
+                cout << "  GrabCut iterations used: " << used << " of " << opts.iterations << endl;
+            }
+            if (metrics) metrics->set("grabcut_iterations", used);
+        }
+        grabCutTimer.stop();
+
+        // Create binary mask (0 = background, 255 = foreground)
+        mask2 = (mask == GC_FGD) | (mask == GC_PR_FGD);
+        mask2.convertTo(mask2, CV_8UC1, 255);
+    }
+
+    return mask2;
+}
+
+// Clean up and refine the edges of a GrabCut mask. ML masks are already soft
+// and are left as they are.
+void refineSegmentation(const Mat& image, Mat& mask, const ProcessingOptions& opts, Metrics* metrics = nullptr) {
+    if (opts.useML) return;
+    refineMask(image, mask, morphologyKernelSize(image.size(), opts), opts, metrics);
+}
+
+// Scale a mask segmented on a reduced or downscaled copy up to `size`, following the
+// edges of the full image like ML upsampling does when `image` is given
+Mat upscaleMask(const Mat& mask, const Mat& image, const Size& size) {
+    Mat full;
+    if (image.empty()) {
+        resize(mask, full, size, 0, 0, INTER_LINEAR);
+    } else {
+        fastGuidedFilter(image, mask, full, kMLGuideRadius, kMLGuideEps, mask.size());
+    }
+    return full;
+}
+
+// Segment a decoded image and return its 8-bit alpha mask. An image over a
+// pixel or memory budget is rejected, or with over-budget=downscale segmented
+// as a smaller copy whose mask is scaled back up along the image's edges.
+Mat computeMask(const Mat& image, const ProcessingOptions& opts, MLModel* model, bool showVerbose,
+                Metrics* metrics) {
+    if (showVerbose) {
+        printProcessingOptions(opts);
+    }
+    ProcessingOptions imageOpts = opts;
+    startDeadline(imageOpts);
+
+    double scale = admitImage(image.size(), imageOpts);
+    Mat segmented = image;
+    if (scale < 1.0) {
+        StageTimer downscaleTimer(metrics, "budget_downscale");
+        resize(image, segmented, Size(), scale, scale, INTER_AREA);
+        downscaleTimer.stop();
+        if (showVerbose) {
+            cout << "  Over budget: segmenting at " << segmented.cols << "x" << segmented.rows << endl;
+        }
+        if (metrics) metrics->set("budget_scale", scale);
+    }
+
+    Mat mask = segmentImage(segmented, imageOpts, model, showVerbose, metrics);
+    checkDeadline(imageOpts, "after segmentation");
+    refineSegmentation(segmented, mask, imageOpts, metrics);
+    if (scale < 1.0) {
+        StageTimer upscaleTimer(metrics, "mask_upscale");
+        mask = upscaleMask(mask, image, image.size());
+    }
+    checkDeadline(imageOpts, "after refinement");
+    return mask;
+}
+
+// Segment several decoded images. ML models with a batch dimension segment
+// them in one inference call; otherwise each image is segmented on its own.
+// `metrics` receives the time for the whole group.
+vector<Mat> computeMasks(const vector<Mat>& images, const ProcessingOptions& opts, MLModel* model, bool showVerbose,
+                         Metrics* metrics = nullptr) {
+#ifdef WITH_ML
+    // Images segmented at a reduced size for a budget go one by one. A group
+    // shares one inference call, so it shares one deadline too; a deadline
+    // already running in `opts` is kept.
+    if (opts.useML && images.size() > 1 &&
+        all_of(images.begin(), images.end(),
+               [&opts](const Mat& image) { return admitImage(image.size(), opts) >= 1.0; })) {
+        ProcessingOptions groupOpts = opts;
+        startDeadline(groupOpts);
+        vector<Mat> masks = runMLSegmentationBatch(images, *model, opts.mlUpsample == "guided", showVerbose, metrics);
+        checkDeadline(groupOpts, "after segmentation");
+        return masks;
+    }
+#endif
+    vector<Mat> masks;
+    for (const Mat& image : images) {
+        masks.push_back(computeMask(image, opts, model, showVerbose, metrics));
+    }
+    return masks;
+}
+
+// Create output image with the mask as alpha channel
+Mat compositeAlpha(const Mat& image, const Mat& mask) {
+    Mat result;
+    vector<Mat> channels;
+    split(image, channels);
+    channels.push_back(mask); // Add alpha channel
+    merge(channels, result);
+    return result;
+}
+
+// Output formats, chosen with --format or from the output file extension:
+//   png   - RGBA PNG (default)
+//   webp  - lossless WebP with alpha
+//   qoi   - RGBA QOI, much faster to encode than PNG
+//   mask  - grayscale PNG of the mask alone
+//   bgra  - raw BGRA pixels, rows top to bottom, no header
+//   alpha - raw 8-bit mask, rows top to bottom, no header
+// The raw formats have the input's dimensions and suit callers that composite
+// the result themselves.
+bool isOutputFormat(const string& format) {
+    return format == "png" || format == "webp" || format == "qoi" ||
+           format == "mask" || format == "bgra" || format == "alpha";
+}
+
+// File extension for a format's batch outputs
+string outputExtension(const string& format) {
+    if (format.empty() || format == "mask") return ".png";
+    return "." + format;
+}
+
+// Format to write `path` in. An empty result means an extension we have no
+// encoder for, which is left to imwrite.
+string resolveOutputFormat(const string& path, const ProcessingOptions& opts) {
+    if (!opts.outputFormat.empty()) return opts.outputFormat;
+    if (path == "-") return "png";
+
+    size_t dot = path.find_last_of('.');
+    string ext = (dot == string::npos) ? "" : path.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == "png" || ext == "webp" || ext == "qoi" || ext == "bgra" || ext == "alpha") return ext;
+    if (ext == "raw") return "bgra";
+    return "";
+}
+
+// Stream buffer that appends to a byte vector, so the stream encoders can
+// produce an in-memory result without the extra copies of ostringstream
+class VectorStreamBuf : public streambuf {
+public:
+    explicit VectorStreamBuf(vector<uchar>& data) : data(data) {}
+
+    vector<uchar>& data;
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            data.push_back(static_cast<uchar>(traits_type::to_char_type(c)));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char* bytes, streamsize count) override {
+        data.insert(data.end(), bytes, bytes + count);
+        return count;
+    }
+};
+
+// Write rows of pixels without any framing
+void writeRaw(ostream& out, const Mat& pixels) {
+    size_t rowBytes = pixels.cols * pixels.elemSize();
+    for (int y = 0; y < pixels.rows; y++) {
+        out.write(reinterpret_cast<const char*>(pixels.ptr(y)), rowBytes);
+    }
+}
+
+// Encode the result to a stream. `mask` is the alpha channel; the BGRA
+// composite is only built for formats that need it.
+void writeOutput(ostream& out, const Mat& image, const Mat& mask, const string& format, int compression,
+                 Metrics* metrics = nullptr) {
+    if (format == "mask" || format == "alpha") {
+        StageTimer encodeTimer(metrics, "encode");
+        if (format == "mask") {
+            PngStreamWriter writer(out, mask.cols, mask.rows, 1, compression);
+            writer.writeImage(mask);
+            writer.finish();
+        } else {
+            writeRaw(out, mask);
+        }
+        return;
+    }
+
+    StageTimer mergeTimer(metrics, "alpha_merge");
+    Mat bgra = compositeAlpha(image, mask);
+    mergeTimer.stop();
+
+    StageTimer encodeTimer(metrics, "encode");
+    if (format == "png") {
+        // Large images are deflated on several threads
+        PngStreamWriter writer(out, bgra.cols, bgra.rows, 4, compression);
+        writer.writeImage(bgra);
+        writer.finish();
+    } else if (format == "webp") {
+        // Quality above 100 selects lossless WebP
+        vector<uchar> buffer;
+        if (!imencode(".webp", bgra, buffer, vector<int>{IMWRITE_WEBP_QUALITY, 101})) {
+            throw runtime_error("Could not encode image to WebP");
+        }
+        out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    } else if (format == "qoi") {
+        // Encode in place when the destination is already a byte vector
+        VectorStreamBuf* sink = dynamic_cast<VectorStreamBuf*>(out.rdbuf());
+        if (sink) {
+            encodeQoi(bgra, sink->data);
+        } else {
+            vector<uchar> buffer = encodeQoi(bgra);
+            out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        }
+    } else {
+        writeRaw(out, bgra);
+    }
+}
+
+// Encode the result into `encoded`, replacing its contents. Its capacity is
+// kept, so a buffer reused across images stops allocating once it has grown
+// to the largest result.
+void encodeOutput(const Mat& image, const Mat& mask, const string& format, int compression,
+                  vector<uchar>& encoded) {
+    encoded.clear();
+    VectorStreamBuf sink(encoded);
+    ostream out(&sink);
+    writeOutput(out, image, mask, format, compression);
+}
+
+// Save the result to a file or stdout in the format chosen for `path`
+void saveImage(const string& path, const Mat& image, const Mat& mask, const ProcessingOptions& opts,
+               Metrics* metrics = nullptr) {
+    string format = resolveOutputFormat(path, opts);
+    if (format.empty()) {
+        // Other extensions (jpg, tiff, ...): let OpenCV pick the encoder
+        StageTimer mergeTimer(metrics, "alpha_merge");
+        Mat bgra = compositeAlpha(image, mask);
+        mergeTimer.stop();
+
+        StageTimer encodeTimer(metrics, "encode");
+        if (!imwrite(path, bgra)) {
+            throw runtime_error("Could not save output image: " + path);
+        }
+        return;
+    }
+
+    if (path == "-") {
+        // Write to stdout
+        #ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+        #endif
+        writeOutput(cout, image, mask, format, opts.compression, metrics);
+        cout.flush();
+        return;
+    }
+
+    ofstream out(path, ios::binary);
+    if (!out) {
+        throw runtime_error("Could not save output image: " + path);
+    }
+    writeOutput(out, image, mask, format, opts.compression, metrics);
+    out.flush();
+    if (!out) {
+        throw runtime_error("Could not write output image: " + path);
+    }
+}
+
+// Rough working memory per pixel, beyond the decoded input, used to decide
+// when to tile and how tall strips can be. Full-resolution GrabCut dominates:
+// OpenCV's graph costs about 170 bytes per pixel. A strip holds labels, seeds,
+// the float guided filter planes and the BGRA/RGBA output rows.
+const double kUntiledBytesPerPixelGrabCut = 200.0;
+const double kUntiledBytesPerPixelML = 40.0;
+const double kStripBytesPerPixel = 64.0;
+const int kDefaultStripRows = 1024;
+const int kMinStripRows = 64;
+
+// Peak resident set size of this process in bytes, or 0 where unsupported
+size_t peakRssBytes() {
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss);
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+// Tile when asked to, or when the untiled pipeline would exceed the memory budget
+bool useTiledPipeline(const Size& size, const ProcessingOptions& opts) {
+    if (opts.tiled) return true;
+    if (opts.maxMemoryMB <= 0) return false;
+    double perPixel = opts.useML ? kUntiledBytesPerPixelML : kUntiledBytesPerPixelGrabCut;
+    return static_cast<double>(size.area()) * perPixel > opts.maxMemoryMB * 1024.0 * 1024.0;
+}
+
+// Memory of an image that downscaled segmentation can't reduce: the
+// full-size image, its mask and the BGRA composite
+const double kFullSizeBytesPerPixel = 8.0;
+
+double admitImage(const Size& size, const ProcessingOptions& opts) {
+    double area = static_cast<double>(size.area());
+    string dims = to_string(size.width) + "x" + to_string(size.height);
+    if (opts.maxDecodedMB > 0 && area * 3 > opts.maxDecodedMB * 1024.0 * 1024.0) {
+        throw BudgetExceeded("Image " + dims + " exceeds the decoded size budget of " +
+                             to_string(opts.maxDecodedMB) + " MB");
+    }
+
+    double scale = 1.0;
+    string budget;
+    if (opts.maxPixels > 0 && area > opts.maxPixels) {
+        scale = sqrt(opts.maxPixels / area);
+        budget = "pixel budget of " + to_string(opts.maxPixels);
+    }
+    if (opts.memoryCeilingMB > 0) {
+        // Same estimate as the tiling decision; strips stay within --max-memory
+        double ceiling = opts.memoryCeilingMB * 1024.0 * 1024.0;
+        double perPixel = opts.useML ? kUntiledBytesPerPixelML : kUntiledBytesPerPixelGrabCut;
+        double fixed = area * kFullSizeBytesPerPixel;
+        double working = area * perPixel;
+        if (useTiledPipeline(size, opts) && opts.maxMemoryMB > 0) {
+            working = min(working, opts.maxMemoryMB * 1024.0 * 1024.0);
+        }
+        if (fixed + working > ceiling) {
+            double fit = fixed < ceiling ? sqrt((ceiling - fixed) / (area * perPixel)) : 0.0;
+            if (fit < scale) {
+                scale = fit;
+                budget = "memory ceiling of " + to_string(opts.memoryCeilingMB) + " MB";
+            }
+        }
+    }
+
+    if (scale >= 1.0) return 1.0;
+    if (opts.overBudget != "downscale" || min(size.width, size.height) * scale < 1.0) {
+        throw BudgetExceeded("Image " + dims + " exceeds the " + budget);
+    }
+    return scale;
+}
+
+// Tiling decision for an admitted image. Images segmented at a reduced size
+// for a budget already fit, so they are never tiled.
+bool tiledWithinBudgets(const Size& size, const ProcessingOptions& opts) {
+    return useTiledPipeline(size, opts) && admitImage(size, opts) >= 1.0;
+}
+
+void checkEncodedImage(const void* data, size_t size, const ProcessingOptions& opts) {
+    const uchar* bytes = static_cast<const uchar*>(data);
+    Size stored;
+    if (encodedImageSize(bytes, size, stored)) {
+        admitImage(orientedSize(stored, jpegExifOrientation(bytes, size)), opts);
+    }
+}
+
+Mat decodeAdmittedImage(const void* data, size_t size, const ProcessingOptions& opts) {
+    checkEncodedImage(data, size, opts);
+    return decodeEncodedImage(static_cast<const uchar*>(data), size);
+}
+
+// Strip height that keeps one strip's working set, plus the GrabCut graphs of
+// the boundary tiles refined in parallel, within the memory budget
+int tiledStripRows(const Mat& image, int overlap, size_t tileGraphPixels, const ProcessingOptions& opts, bool showVerbose) {
+    if (opts.maxMemoryMB <= 0) return max(kDefaultStripRows, overlap);
+
+    double budget = opts.maxMemoryMB * 1024.0 * 1024.0
+                  - static_cast<double>(getNumThreads()) * tileGraphPixels * kUntiledBytesPerPixelGrabCut;
+    int rows = static_cast<int>(budget / (image.cols * kStripBytesPerPixel)) - 2 * overlap;
+    if (rows < kMinStripRows && showVerbose) {
+        cout << "  Memory budget of " << opts.maxMemoryMB << " MB is below the minimum strip size; using "
+             << max(kMinStripRows, overlap) << " rows" << endl;
+    }
+    return max(max(kMinStripRows, overlap), rows);
+}
+
+// Remove the background of a large image in horizontal strips and stream the
+// result to `out` as PNG. Segmentation runs once at reduced resolution (the
+// coarse GrabCut pass, or the ML model). Each strip upsamples its rows of that
+// mask, refines them at full resolution with `overlap` rows of context above
+// and below, and is blended with the previous strip across a short seam.
+// Only the decoded input and one strip's working set are held at a time.
+void removeBackgroundTiled(const Mat& image, ostream& out, const string& format, const ProcessingOptions& opts,
+                           MLModel* model, bool showVerbose, Metrics* metrics = nullptr) {
+    if (showVerbose) {
+        printProcessingOptions(opts);
+    }
+
+    double scale = min(1.0, static_cast<double>(opts.coarseMaxDim) / max(image.cols, image.rows));
+    Rect rectangle = grabCutRect(image.size(), opts);
+
+    Mat coarse;
+#ifdef WITH_ML
+    if (opts.useML) {
+        // The model sees a few hundred pixels, so segment a reduced copy
+        Mat small;
+        resize(image, small, Size(), scale, scale, INTER_AREA);
+        coarse = runMLSegmentation(small, *model, opts.mlUpsample == "guided", showVerbose, metrics);
+    } else
+#endif
+    {
+        StageTimer grabCutTimer(metrics, "grabcut");
+        coarse = coarseGrabCut(image, rectangle, scale, opts, showVerbose);
+    }
+
+    // The ML mask is only interpolated, which needs no context. GrabCut strips
+    // need the band tiles' reach plus room for morphology and the edge filter.
+    int kernel_size = morphologyKernelSize(image.size(), opts);
+    int band = boundaryBandWidth(scale);
+    int overlap = opts.useML ? 0 : band + 4 * kernel_size + 16;
+    int seam = overlap / 2;
+    int tileSide = max(128, band * 16) + 2 * band;
+    size_t tileGraphPixels = opts.useML ? 0 : static_cast<size_t>(tileSide) * tileSide;
+    int stripRows = tiledStripRows(image, overlap, tileGraphPixels, opts, showVerbose);
+
+    if (showVerbose) {
+        cout << "  Tiled: " << (image.rows + stripRows - 1) / stripRows << " strips of "
+             << stripRows << " rows, " << overlap << " rows overlap" << endl;
+    }
+    if (metrics) {
+        metrics->set("strip_rows", stripRows);
+        metrics->set("strip_overlap", overlap);
+        if (!opts.useML) metrics->set("boundary_band", band);
+    }
+
+    // Coarse-to-full mapping through pixel centers in full-image coordinates,
+    // so neighbouring strips interpolate identical values on shared rows
+    double sx = static_cast<double>(coarse.cols) / image.cols;
+    double sy = static_cast<double>(coarse.rows) / image.rows;
+    // Raw formats are written as they are, PNG goes through the streaming encoder
+    bool alphaOnly = (format == "mask" || format == "alpha");
+    unique_ptr<PngStreamWriter> writer;
+    if (format == "png" || format == "mask") {
+        writer.reset(new PngStreamWriter(out, image.cols, image.rows, alphaOnly ? 1 : 4, opts.compression));
+    }
+    Mat carry;  // Previous strip's mask for the seam rows below its core
+    for (int y0 = 0; y0 < image.rows; y0 += stripRows) {
+        checkDeadline(opts, "after " + to_string(y0) + " rows");
+        int y1 = min(image.rows, y0 + stripRows);
+        int c0 = max(0, y0 - overlap);
+        int c1 = min(image.rows, y1 + overlap);
+        Mat stripImage = image(Range(c0, c1), Range::all());
+
+        Mat toStrip = (Mat_<double>(2, 3) << sx, 0, 0.5 * sx - 0.5,
+                                             0, sy, (c0 + 0.5) * sy - 0.5);
+        StageTimer upsampleTimer(metrics, "mask_upsample");
+        Mat mask;
+        warpAffine(coarse, mask, toStrip, stripImage.size(), INTER_LINEAR | WARP_INVERSE_MAP, BORDER_REPLICATE);
+        upsampleTimer.stop();
+
+        if (!opts.useML) {
+            StageTimer refineTimer(metrics, "grabcut_refine");
+            threshold(mask, mask, 127, 255, THRESH_BINARY);
+            Rect stripRect = Rect(rectangle.x, rectangle.y - c0, rectangle.width, rectangle.height) &
+                             Rect(0, 0, stripImage.cols, stripImage.rows);
+            Mat labels = refineBoundaryBand(stripImage, mask, stripRect, band, opts, false);
+            mask = (labels == GC_FGD) | (labels == GC_PR_FGD);
+            refineTimer.stop();
+            refineMask(stripImage, mask, kernel_size, opts, metrics);
+        }
+
+        // Fade from the previous strip's mask to this one across the seam
+        int blendRows = min(carry.rows, y1 - y0);
+        for (int i = 0; i < blendRows; i++) {
+            double weight = (i + 1.0) / (blendRows + 1.0);
+            Mat row = mask.row(y0 - c0 + i);
+            addWeighted(carry.row(i), 1.0 - weight, row, weight, 0.0, row);
+        }
+        int seamEnd = min(image.rows, y1 + seam);
+        carry = mask(Range(y1 - c0, seamEnd - c0), Range::all()).clone();
+
+        Range core(y0 - c0, y1 - c0);
+        Mat rows = mask(core, Range::all());
+        if (!alphaOnly) {
+            StageTimer mergeTimer(metrics, "alpha_merge");
+            rows = compositeAlpha(stripImage(core, Range::all()), rows);
+        }
+
+        StageTimer encodeTimer(metrics, "encode");
+        if (writer) {
+            writer->writeRows(rows);
+        } else {
+            writeRaw(out, rows);
+        }
+    }
+    StageTimer encodeTimer(metrics, "encode");
+    if (writer) {
+        writer->finish();
+    }
+    out.flush();
+    if (!out) {
+        throw runtime_error("Could not write output image");
+    }
+}
+
+// Run the tiled pipeline and write the result to a file or stdout. Strips
+// are encoded as they finish, so only formats written row by row work here.
+void saveTiled(const Mat& image, const string& outputPath, const ProcessingOptions& opts, MLModel* model, bool showVerbose,
+               Metrics* metrics = nullptr) {
+    string format = resolveOutputFormat(outputPath, opts);
+    if (format != "png" && format != "mask" && format != "bgra" && format != "alpha") {
+        throw runtime_error("Tiled processing writes png, mask, bgra or alpha output only");
+    }
+    if (metrics) metrics->set("tiled", 1);
+
+    if (outputPath == "-") {
+        #ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+        #endif
+        removeBackgroundTiled(image, cout, format, opts, model, showVerbose, metrics);
+        return;
+    }
+
+    ofstream out(outputPath, ios::binary);
+    if (!out) {
+        throw runtime_error("Could not save output image: " + outputPath);
+    }
+    removeBackgroundTiled(image, out, format, opts, model, showVerbose, metrics);
+}
+
+// Describe an image and the options it is processed with in its metrics
+void recordImageMetrics(Metrics* metrics, const Size& size, const ProcessingOptions& opts) {
+    if (!metrics) return;
+    metrics->set("width", size.width);
+    metrics->set("height", size.height);
+    metrics->set("mode", opts.useML ? "ml" : "grabcut");
+    if (!opts.useML) {
+        metrics->set("quality", opts.quality);
+        metrics->set("edge_mode", opts.edgeMode);
+        metrics->set("iterations", opts.iterations);
+    }
+}
+
+// Mask cache key: the encoded input bytes plus every option and the model
+// that affect the mask, so a changed setting never returns a stale mask.
+// Output options (format, compression) are left out, so re-encoding an image
+// in another format is a hit.
+string maskCacheKey(const EncodedInput& input, const ProcessingOptions& opts, const MLModel* model) {
+    ostringstream settings;
+    settings << "v1";
+    if (opts.useML) {
+        settings << "|ml|" << hashHex(mlModelHash(model)) << "|" << opts.modelNorm << "|" << opts.mlUpsample;
+    } else {
+        settings << "|grabcut|" << opts.iterations << "|" << opts.margin << "|" << opts.edgeMode << "|"
+                 << opts.kernelScale << "|" << opts.coarseToFine << "|" << opts.coarseMaxDim << "|"
+                 << opts.refineIterations << "|" << opts.adaptive << "|" << opts.convergence;
+    }
+    if (opts.overBudget == "downscale") {
+        // Budgets that may shrink the segmented copy
+        settings << "|downscale|" << opts.maxPixels << "|" << opts.memoryCeilingMB;
+    }
+    string key = settings.str();
+    return hashHex(hashBytes(key.data(), key.size(), hashBytes(input.data(), input.size())));
+}
+
+// Decode an input, after checking its header against the budgets. With a
+// mask cache, the cache key of the encoded bytes is computed on the way.
+Mat loadImageKeyed(const string& path, const ProcessingOptions& opts, const MLModel* model, MaskCache* cache,
+                   string& cacheKey) {
+    EncodedInput input = readInput(path);
+    checkEncodedImage(input.data(), input.size(), opts);
+    if (cache) cacheKey = maskCacheKey(input, opts, model);
+    return decodeImage(input, path);
+}
+
+// Look up an image's mask in the cache. Returns false on a miss or without a cache.
+bool lookupMask(MaskCache* cache, const string& key, const Size& size, Mat& mask, Metrics* metrics) {
+    if (!cache) return false;
+    StageTimer lookupTimer(metrics, "cache_lookup");
+    bool hit = cache->load(key, mask) && mask.size() == size;
+    lookupTimer.stop();
+    if (metrics) metrics->set("mask_cache", hit ? "hit" : "miss");
+    return hit;
+}
+
+void storeMask(MaskCache* cache, const string& key, const Mat& mask, Metrics* metrics) {
+    if (!cache) return;
+    StageTimer storeTimer(metrics, "cache_store");
+    cache->store(key, mask);
+}
+
+// Reduction (2, 4 or 8) of the JPEG decode that ML segmentation runs on: the
+// largest that keeps the image's shorter side at least the model's input
+// size, so the model sees the same detail as from a full decode. Returns 1
+// where a reduced decode doesn't apply: GrabCut, which works at full
+// resolution; other formats; images for the tiled pipeline. Otherwise `size`
+// receives the full, upright image size from the JPEG header.
+int segmentationReduction(const EncodedInput& input, const ProcessingOptions& opts, const MLModel* model,
+                          Size& size) {
+    Size stored;
+    if (!opts.useML || !isJpeg(input.data(), input.size()) ||
+        !encodedImageSize(input.data(), input.size(), stored) || useTiledPipeline(stored, opts)) {
+        return 1;
+    }
+    Size modelSize = mlInputSize(model);
+    int needed = max(modelSize.width, modelSize.height);
+    int shorter = min(stored.width, stored.height);
+    int reduction = 1;
+    while (needed > 0 && reduction < 8 && shorter / (reduction * 2) >= needed) {
+        reduction *= 2;
+    }
+    size = orientedSize(stored, jpegExifOrientation(input.data(), input.size()));
+    return reduction;
+}
+
+void removeBackground(const string& inputPath, const string& outputPath, const ProcessingOptions& baseOpts,
+                      MLModel* model, Metrics* metrics, MaskCache* cache) {
+    ProcessingOptions opts = baseOpts;
+    startDeadline(opts);
+
+    // Read input image (from file or stdin). Budgets are checked against the
+    // header first. ML segmentation of a large JPEG runs on a reduced decode;
+    // the full image is decoded afterwards, and only if the output or the
+    // mask upsampling needs it.
+    StageTimer decodeTimer(metrics, "decode");
+    EncodedInput input = readInput(inputPath);
+    checkEncodedImage(input.data(), input.size(), opts);
+    string cacheKey = cache ? maskCacheKey(input, opts, model) : "";
+    Size size;
+    int reduction = segmentationReduction(input, opts, model, size);
+    Mat image;
+    if (reduction == 1) {
+        image = decodeImage(input, inputPath);
+        size = image.size();
+    }
+    decodeTimer.stop();
+    recordImageMetrics(metrics, size, opts);
+    // Formats without a readable header are only checked once decoded
+    admitImage(size, opts);
+    checkDeadline(opts, "after decoding");
+
+    // Suppress verbose output when writing to stdout to avoid corrupting image data
+    bool showVerbose = opts.verbose && (outputPath != "-");
+
+    if (showVerbose) {
+        cout << "Image loaded: " << size.width << "x" << size.height;
+        if (reduction > 1) cout << " (segmented from a 1/" << reduction << " decode)";
+        cout << endl;
+    }
+
+    if (reduction == 1 && tiledWithinBudgets(size, opts)) {
+        // Large image: segment and encode strip by strip. Its mask is never
+        // held whole, so it bypasses the mask cache.
+        saveTiled(image, outputPath, opts, model, showVerbose, metrics);
+    } else {
+        string format = resolveOutputFormat(outputPath, opts);
+        bool maskOnly = format == "mask" || format == "alpha";
+        Mat mask;
+        if (lookupMask(cache, cacheKey, size, mask, metrics)) {
+            if (showVerbose) {
+                cout << "Mask cache hit: " << cacheKey << endl;
+            }
+        } else {
+            if (reduction > 1) {
+                StageTimer reducedTimer(metrics, "decode_reduced");
+                Mat reduced = decodeImage(input, inputPath, reduction);
+                reducedTimer.stop();
+                mask = computeMask(reduced, opts, model, showVerbose, metrics);
+                if (opts.mlUpsample == "guided" || !maskOnly) {
+                    StageTimer fullTimer(metrics, "decode");
+                    image = decodeImage(input, inputPath);
+                }
+                StageTimer upscaleTimer(metrics, "mask_upscale");
+                mask = upscaleMask(mask, opts.mlUpsample == "guided" ? image : Mat(), size);
+                upscaleTimer.stop();
+            } else {
+                mask = computeMask(image, opts, model, showVerbose, metrics);
+            }
+            storeMask(cache, cacheKey, mask, metrics);
+            if (showVerbose && cache) {
+                cout << "Mask cache miss, stored: " << cacheKey << endl;
+            }
+        }
+
+        // Save output (to file or stdout). Mask-only formats never read the image.
+        if (image.empty() && !maskOnly) {
+            StageTimer fullTimer(metrics, "decode");
+            image = decodeImage(input, inputPath);
+        }
+        checkDeadline(opts, "before encoding");
+        saveImage(outputPath, image, mask, opts, metrics);
+    }
+
+    if (showVerbose) {
+        size_t rss = peakRssBytes();
+        if (rss > 0) {
+            cout << "Peak RSS: " << rss / (1024 * 1024) << " MB" << endl;
+        }
+    }
+
+    // Success message (skip for stdout to avoid mixing with image data)
+    if (outputPath != "-") {
+        cout << "✅ Background removed successfully → " << outputPath << endl;
+    }
+}
+
+// Check whether a path has an image extension we process in directory/glob batches
+bool hasImageExtension(const string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == string::npos) return false;
+    string ext = path.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp" ||
+           ext == "tif" || ext == "tiff" || ext == "webp";
+}
+
+// Derive "<outputDir>/<name><extension>" from an input path. With
+// keepSourceExtension, the input's extension stays in the name
+// ("photo.jpg" -> "photo.jpg.png").
+string batchOutputPath(const string& inputPath, const string& outputDir, const string& extension,
+                       bool keepSourceExtension = false) {
+    size_t slash = inputPath.find_last_of("/\\");
+    string filename = (slash == string::npos) ? inputPath : inputPath.substr(slash + 1);
+    size_t dot = filename.find_last_of('.');
+    string name = (dot == string::npos || keepSourceExtension) ? filename : filename.substr(0, dot);
+    return outputDir + "/" + name + extension;
+}
+
+// Make sure no two items write the same file. Derived outputs that collide
+// (photo.jpg and photo.png both -> photo.png) keep their source extension;
+// a collision that remains, e.g. between explicit manifest outputs, is an error.
+void resolveOutputCollisions(vector<BatchItem>& items, const vector<bool>& derived, const string& outputDir,
+                             const string& extension) {
+    map<string, int> uses;
+    for (const BatchItem& item : items) uses[item.output]++;
+    for (size_t i = 0; i < items.size(); i++) {
+        if (derived[i] && uses[items[i].output] > 1) {
+            items[i].output = batchOutputPath(items[i].input, outputDir, extension, true);
+        }
+    }
+
+    map<string, string> writers;
+    for (const BatchItem& item : items) {
+        auto inserted = writers.insert({item.output, item.input});
+        if (!inserted.second) {
+            throw runtime_error("Batch inputs " + inserted.first->second + " and " + item.input +
+                                " would both write " + item.output);
+        }
+    }
+}
+
+// Collect batch inputs from a directory, a glob pattern, or a manifest file.
+// Manifest lines hold an input path, optionally followed by a tab and an
+// explicit output path. Blank lines and lines starting with '#' are ignored.
+vector<BatchItem> collectBatch(const string& source, const string& outputDir, const string& extension) {
+    vector<BatchItem> items;
+    vector<bool> derived;
+
+    if (source.find_first_of("*?") != string::npos || utils::fs::isDirectory(source)) {
+        vector<String> files;
+        glob(source, files, false);
+        sort(files.begin(), files.end());
+        for (const String& file : files) {
+            if (hasImageExtension(file)) {
+                items.push_back({file, batchOutputPath(file, outputDir, extension)});
+                derived.push_back(true);
+            }
+        }
+        resolveOutputCollisions(items, derived, outputDir, extension);
+        return items;
+    }
+
+    ifstream manifest(source);
+    if (!manifest) {
+        throw runtime_error("Could not open batch manifest: " + source);
+    }
+
+    string line;
+    while (getline(manifest, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            items.push_back({line, batchOutputPath(line, outputDir, extension)});
+            derived.push_back(true);
+        } else {
+            items.push_back({line.substr(0, tab), line.substr(tab + 1)});
+            derived.push_back(false);
+        }
+    }
+    resolveOutputCollisions(items, derived, outputDir, extension);
+    return items;
+}
+
+// Finish an image's metrics with its paths, outcome and peak RSS so far, and
+// write it as one JSON line
+void writeMetrics(ostream& out, Metrics& metrics, const string& input, const string& output, const string& error) {
+    metrics.set("input", input);
+    metrics.set("output", output);
+    metrics.set("status", error.empty() ? "ok" : "error");
+    if (!error.empty()) metrics.set("error", error);
+    metrics.set("peak_rss_bytes", static_cast<double>(peakRssBytes()));
+    out << metrics.toJson() << endl;
+}
+
+// Process every batch item with the shared options and model, reporting each
+// result instead of aborting on the first bad file. In ML mode, images are
+// decoded in groups of the model's batch size and segmented with one inference
+// call per group. With `metricsOut`, one JSON line per image is written there;
+// a group's segmentation time is reported in full for each of its images.
+// Images found in the mask cache are written as soon as they are decoded.
+RunSummary runBatch(const vector<BatchItem>& items, const ProcessingOptions& opts, MLModel* model,
+                    ostream* metricsOut, MaskCache* cache) {
+    int succeeded = 0;
+    RunSummary summary;
+    int64 start = getTickCount();
+
+    size_t group = opts.useML ? mlBatchCapacity(model) : 1;
+
+    for (size_t first = 0; first < items.size(); first += group) {
+        size_t last = min(items.size(), first + group);
+        vector<Metrics> metrics(last - first);
+        auto metricsFor = [&](size_t i) { return metricsOut ? &metrics[i - first] : nullptr; };
+        auto report = [&](size_t i, const string& error, bool overBudget = false) {
+            if (error.empty()) {
+                cout << "✅ Background removed successfully → " << items[i].output << endl;
+                succeeded++;
+            } else {
+                cerr << "❌ " << items[i].input << ": " << error << endl;
+                summary.failed++;
+                if (overBudget) summary.overBudget++;
+            }
+            if (metricsOut) writeMetrics(*metricsOut, metrics[i - first], items[i].input, items[i].output, error);
+        };
+
+        // Decode the group, dropping images that fail to load. Each image's
+        // deadline starts before it is read.
+        vector<size_t> indices;
+        vector<Mat> images;
+        vector<string> keys;
+        vector<ProcessingOptions> imageOpts;
+        for (size_t i = first; i < last; i++) {
+            if (opts.verbose) {
+                cout << "Processing: " << items[i].input << endl;
+            }
+            try {
+                ProcessingOptions itemOpts = opts;
+                startDeadline(itemOpts);
+                StageTimer decodeTimer(metricsFor(i), "decode");
+                string key;
+                Mat image = loadImageKeyed(items[i].input, itemOpts, model, cache, key);
+                decodeTimer.stop();
+                recordImageMetrics(metricsFor(i), image.size(), itemOpts);
+                admitImage(image.size(), itemOpts);
+
+                Mat mask;
+                if (!tiledWithinBudgets(image.size(), itemOpts) &&
+                    lookupMask(cache, key, image.size(), mask, metricsFor(i))) {
+                    checkDeadline(itemOpts, "before encoding");
+                    saveImage(items[i].output, image, mask, itemOpts, metricsFor(i));
+                    report(i, "");
+                    continue;
+                }
+                images.push_back(image);
+                indices.push_back(i);
+                keys.push_back(key);
+                imageOpts.push_back(itemOpts);
+            } catch (const exception& e) {
+                report(i, e.what(), isOverBudget(e));
+            }
+        }
+
+        // Images over the memory budget go through the strip pipeline on their own
+        for (size_t k = 0; k < images.size();) {
+            if (!tiledWithinBudgets(images[k].size(), opts)) {
+                k++;
+                continue;
+            }
+            size_t i = indices[k];
+            try {
+                saveTiled(images[k], items[i].output, imageOpts[k], model, opts.verbose, metricsFor(i));
+                report(i, "");
+            } catch (const exception& e) {
+                report(i, e.what(), isOverBudget(e));
+            }
+            images.erase(images.begin() + k);
+            indices.erase(indices.begin() + k);
+            keys.erase(keys.begin() + k);
+            imageOpts.erase(imageOpts.begin() + k);
+        }
+        if (images.empty()) continue;
+
+        // A group is segmented together, so it runs against the earliest
+        // deadline in it: the first image's, which was read first
+        vector<Mat> masks;
+        Metrics groupMetrics;
+        try {
+            masks = computeMasks(images, imageOpts.front(), model, opts.verbose, metricsOut ? &groupMetrics : nullptr);
+        } catch (const exception& e) {
+            for (size_t i : indices) {
+                report(i, e.what(), isOverBudget(e));
+            }
+            continue;
+        }
+
+        for (size_t k = 0; k < indices.size(); k++) {
+            size_t i = indices[k];
+            Metrics* itemMetrics = metricsFor(i);
+            if (itemMetrics) {
+                itemMetrics->merge(groupMetrics);
+                if (opts.useML) itemMetrics->set("ml_batch_images", static_cast<double>(images.size()));
+            }
+            try {
+                storeMask(cache, keys[k], masks[k], itemMetrics);
+                checkDeadline(imageOpts[k], "before encoding");
+                saveImage(items[i].output, images[k], masks[k], imageOpts[k], itemMetrics);
+                report(i, "");
+            } catch (const exception& e) {
+                report(i, e.what(), isOverBudget(e));
+            }
+        }
+    }
+
+    double seconds = (getTickCount() - start) / getTickFrequency();
+    cout << "Batch complete: " << succeeded << " succeeded, " << summary.failed << " failed in "
+         << seconds << "s (" << (seconds > 0 ? items.size() / seconds : 0) << " images/s)" << endl;
+    return summary;
+}
+
+// An image moving through the --jobs pipeline
+struct PipelineItem {
+    size_t index = 0;
+    int stage = 0;       // next stage to run
+    bool tiled = false;  // over the memory budget: tiled end to end in the segment stage
+    string cacheKey;
+    ProcessingOptions opts;  // the run's options, with this image's deadline
+    Mat image;
+    Mat segmented;       // the image, or a smaller copy that fits the budgets
+    Mat mask;
+    Metrics metrics;
+};
+
+// Process a batch on `jobs` worker threads. Each image passes through four
+// stages (decode, segment, refine, encode) with a ready queue in front of
+// each. A worker always takes the most advanced work available (encode before
+// refine before segment) and only decodes a new image when nothing else is
+// ready, so an idle worker picks up whichever stage is behind instead of
+// waiting on one of its own, and finished images leave the pipeline as soon
+// as possible. At most 2 × jobs decoded images are in flight, which bounds
+// memory regardless of batch size and is also the bound on each ready queue.
+// All queues share one lock. A stage runs for tens to thousands of
+// milliseconds against a few microseconds of queue work, so the lock is not
+// contended at any useful job count, and per-worker deques with stealing would
+// add nothing but complexity. OpenCV's own thread pool is shrunk to
+// cores / jobs so the two levels of parallelism don't oversubscribe the CPU.
+// ML models are shared by all workers (each thread gets its own scratch
+// buffers); --ml-batch grouping does not apply here. Images found in the
+// mask cache go straight from decode to encode. With more than one job,
+// per-image metrics leave out cpu_ms, since process CPU time would include the
+// other jobs' images.
+RunSummary runBatchPipelined(const vector<BatchItem>& items, const ProcessingOptions& opts, MLModel* model, int jobs,
+                             ostream* metricsOut, MaskCache* cache) {
+    enum { Decode, Segment, Refine, Encode, StageCount };
+
+    int cores = max(1, getNumberOfCPUs());
+    int cvThreads = max(1, cores / jobs);
+    int previousCvThreads = getNumThreads();
+    setNumThreads(cvThreads);
+
+    if (opts.verbose) {
+        printProcessingOptions(opts);
+        cout << "Pipeline: " << jobs << " jobs, " << cvThreads << " OpenCV threads each, "
+             << 2 * jobs << " images in flight" << endl;
+    }
+
+    mutex mtx;
+    condition_variable changed;
+    deque<PipelineItem> ready[StageCount];
+    size_t nextInput = 0;
+    size_t inFlight = 0;
+    size_t maxInFlight = 2 * static_cast<size_t>(jobs);
+    int succeeded = 0;
+    RunSummary summary;
+    int64 start = getTickCount();
+
+    // Called with the lock held once an image is written or has failed
+    auto finish = [&](PipelineItem& item, const string& error, bool overBudget) {
+        const BatchItem& batchItem = items[item.index];
+        if (error.empty()) {
+            cout << "✅ Background removed successfully → " << batchItem.output << endl;
+            succeeded++;
+        } else {
+            cerr << "❌ " << batchItem.input << ": " << error << endl;
+            summary.failed++;
+            if (overBudget) summary.overBudget++;
+        }
+        if (metricsOut) {
+            if (jobs > 1) item.metrics.omitCpuTimes();
+            writeMetrics(*metricsOut, item.metrics, batchItem.input, batchItem.output, error);
+        }
+        inFlight--;
+    };
+
+    // Run one stage of one image; returns true when the image is done
+    auto runStage = [&](PipelineItem& item) {
+        const BatchItem& batchItem = items[item.index];
+        Metrics* metrics = metricsOut ? &item.metrics : nullptr;
+        switch (item.stage) {
+            case Decode: {
+                item.opts = opts;
+                startDeadline(item.opts);
+                StageTimer decodeTimer(metrics, "decode");
+                item.image = loadImageKeyed(batchItem.input, item.opts, model, cache, item.cacheKey);
+                decodeTimer.stop();
+                recordImageMetrics(metrics, item.image.size(), item.opts);
+                double scale = admitImage(item.image.size(), item.opts);
+                item.tiled = tiledWithinBudgets(item.image.size(), item.opts);
+                if (!item.tiled && lookupMask(cache, item.cacheKey, item.image.size(), item.mask, metrics)) {
+                    item.stage = Refine;  // advanced to Encode by the caller
+                    return false;
+                }
+                item.segmented = item.image;
+                if (scale < 1.0) {
+                    resize(item.image, item.segmented, Size(), scale, scale, INTER_AREA);
+                    if (metrics) metrics->set("budget_scale", scale);
+                }
+                return false;
+            }
+            case Segment:
+                checkDeadline(item.opts, "before segmentation");
+                if (item.tiled) {
+                    saveTiled(item.image, batchItem.output, item.opts, model, false, metrics);
+                    return true;
+                }
+                item.mask = segmentImage(item.segmented, item.opts, model, false, metrics);
+                return false;
+            case Refine:
+                checkDeadline(item.opts, "before refinement");
+                refineSegmentation(item.segmented, item.mask, item.opts, metrics);
+                if (item.segmented.size() != item.image.size()) {
+                    StageTimer upscaleTimer(metrics, "mask_upscale");
+                    item.mask = upscaleMask(item.mask, item.image, item.image.size());
+                }
+                item.segmented.release();
+                storeMask(cache, item.cacheKey, item.mask, metrics);
+                return false;
+            default:
+                checkDeadline(item.opts, "before encoding");
+                saveImage(batchItem.output, item.image, item.mask, item.opts, metrics);
+                return true;
+        }
+    };
+
+    auto worker = [&] {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            PipelineItem item;
+            bool haveWork = false;
+            for (int stage = Encode; stage > Decode && !haveWork; stage--) {
+                if (!ready[stage].empty()) {
+                    item = move(ready[stage].front());
+                    ready[stage].pop_front();
+                    haveWork = true;
+                }
+            }
+            if (!haveWork && nextInput < items.size() && inFlight < maxInFlight) {
+                item.index = nextInput++;
+                item.stage = Decode;
+                inFlight++;
+                haveWork = true;
+            }
+            if (!haveWork) {
+                if (nextInput == items.size() && inFlight == 0) break;
+                changed.wait(lock);
+                continue;
+            }
+
+            lock.unlock();
+            string error;
+            bool done = false;
+            bool overBudget = false;
+            try {
+                done = runStage(item);
+            } catch (const exception& e) {
+                error = e.what();
+                overBudget = isOverBudget(e);
+                done = true;
+            }
+            // Release pixels before waiting on the lock
+            if (done) {
+                item.image.release();
+                item.segmented.release();
+                item.mask.release();
+            }
+            lock.lock();
+
+            if (done) {
+                finish(item, error, overBudget);
+            } else {
+                item.stage++;
+                ready[item.stage].push_back(move(item));
+            }
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> pool;
+    for (int i = 0; i < jobs; i++) {
+        pool.emplace_back(worker);
+    }
+    for (thread& t : pool) {
+        t.join();
+    }
+    setNumThreads(previousCvThreads);
+
+    double seconds = (getTickCount() - start) / getTickFrequency();
+    cout << "Batch complete: " << succeeded << " succeeded, " << summary.failed << " failed in "
+         << seconds << "s (" << (seconds > 0 ? items.size() / seconds : 0) << " images/s)" << endl;
+    return summary;
+}
+
+// Small grayscale copy of a frame for cheap frame-to-frame comparison
+Mat frameThumbnail(const Mat& frame) {
+    Mat gray, thumb;
+    cvtColor(frame, gray, COLOR_BGR2GRAY);
+    int width = min(64, gray.cols);
+    resize(gray, thumb, Size(width, max(1, gray.rows * width / gray.cols)), 0, 0, INTER_AREA);
+    return thumb;
+}
+
+// Mean absolute difference of two thumbnails, from 0 (identical) to 1
+double frameDifference(const Mat& a, const Mat& b) {
+    if (a.empty() || b.empty() || a.size() != b.size()) return 1.0;
+    Mat diff;
+    absdiff(a, b, diff);
+    return mean(diff)[0] / 255.0;
+}
+
+// How far the subject's edge may move between frames; the band around the
+// previous boundary that tracked GrabCut is free to relabel
+int temporalBandWidth(Size size) {
+    return max(8, min(size.width, size.height) / 30);
+}
+
+// Seed GrabCut from the previous frame's labels: well inside the previous
+// foreground is definite foreground, well outside it is definite background,
+// the band between is probable either way, and everything outside `rect` stays
+// background as in a fresh start. Returns an empty Mat when the previous frame
+// has no foreground or no background to learn from.
+Mat seedFromPreviousLabels(const Mat& labels, const Rect& rect, int band) {
+    Mat fg = (labels == GC_FGD) | (labels == GC_PR_FGD);
+    Mat kernel = getStructuringElement(MORPH_ELLIPSE, Size(2 * band + 1, 2 * band + 1));
+    Mat inner, outer;
+    erode(fg, inner, kernel);
+    dilate(fg, outer, kernel);
+
+    Mat seeds(labels.size(), CV_8UC1, Scalar(GC_BGD));
+    Mat(seeds, rect).setTo(Scalar(GC_PR_BGD), Mat(outer, rect));
+    Mat(seeds, rect).setTo(Scalar(GC_PR_FGD), Mat(fg, rect));
+    Mat(seeds, rect).setTo(Scalar(GC_FGD), Mat(inner, rect));
+
+    int foreground = countNonZero((seeds == GC_FGD) | (seeds == GC_PR_FGD));
+    if (foreground == 0 || foreground == static_cast<int>(seeds.total())) return Mat();
+    return seeds;
+}
+
+// GrabCut state carried from one frame of a sequence to the next
+struct TemporalGrabCut {
+    Mat labels;      // previous frame's labels, before refinement
+    Mat bgModel;     // GMMs learned on the previous frame
+    Mat fgModel;
+    Mat thumbnail;   // previous frame, for scene cut detection
+};
+
+// Segment one frame of a sequence with GrabCut. The first frame, a frame
+// after a scene cut, or a frame whose subject was lost starts over from the
+// rectangle with the full iteration count. Every other frame starts from the
+// previous frame's labels and GMMs and runs only opts.temporalIterations, so
+// k-means initialization is skipped and the mask stays stable between frames.
+// Returns the binary mask before refinement and sets `keyframe`.
+Mat segmentFrameTracked(const Mat& frame, const Mat& thumbnail, TemporalGrabCut& state, const ProcessingOptions& opts,
+                        bool& keyframe, int& iterationsUsed, Metrics* metrics) {
+    Rect rect = grabCutRect(frame.size(), opts);
+
+    Mat seeds;
+    keyframe = state.labels.empty() || state.labels.size() != frame.size() ||
+               frameDifference(thumbnail, state.thumbnail) > opts.sceneCut;
+    if (!keyframe) {
+        seeds = seedFromPreviousLabels(state.labels, rect, temporalBandWidth(frame.size()));
+        keyframe = seeds.empty();
+    }
+
+    StageTimer grabCutTimer(metrics, "grabcut");
+    if (keyframe) {
+        state.labels = Mat::zeros(frame.size(), CV_8UC1);
+        state.bgModel.release();
+        state.fgModel.release();
+        iterationsUsed = runGrabCut(frame, state.labels, rect, state.bgModel, state.fgModel, opts, GC_INIT_WITH_RECT);
+    } else {
+        // GC_EVAL keeps the carried-over GMMs as the starting point;
+        // GC_INIT_WITH_MASK would re-learn them from scratch
+        ProcessingOptions trackOpts = opts;
+        trackOpts.iterations = opts.temporalIterations;
+        state.labels = seeds;
+        iterationsUsed = runGrabCut(frame, state.labels, rect, state.bgModel, state.fgModel, trackOpts, GC_EVAL);
+    }
+    grabCutTimer.stop();
+    state.thumbnail = thumbnail;
+    if (metrics) metrics->set("grabcut_iterations", iterationsUsed);
+
+    Mat mask = (state.labels == GC_FGD) | (state.labels == GC_PR_FGD);
+    mask.convertTo(mask, CV_8UC1, 255);
+    return mask;
+}
+
+// Where frame `index` of a sequence goes: a printf-style pattern
+// ("out/%04d.png") gets the frame index, anything else is a directory of
+// frame_NNNNNN files. Raw formats are streamed instead (see runSequence).
+string sequenceFramePath(const string& output, const string& extension, int index) {
+    if (output.find('%') != string::npos) {
+        char path[4096];
+        snprintf(path, sizeof(path), output.c_str(), index);
+        return path;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/frame_%06d", index);
+    return output + name + extension;
+}
+
+// Remove the background from every frame of a video or numbered image
+// sequence (anything VideoCapture opens, e.g. "frames/%04d.jpg"). GrabCut
+// tracks the subject from frame to frame (see segmentFrameTracked); the ML
+// path reuses the last mask while frames stay within opts.mlSkipThreshold of
+// the last frame it ran inference on. Frames are written as numbered images,
+// or, for the raw bgra/alpha formats, appended to one stream that can be piped
+// into an encoder for video with alpha. Each frame reports its time and how it
+// was segmented, and gets the budgets and deadline of one image.
+RunSummary runSequence(const string& source, const string& output, const ProcessingOptions& opts, MLModel* model,
+                       ostream* metricsOut) {
+    VideoCapture capture(source);
+    if (!capture.isOpened()) {
+        throw runtime_error("Could not open sequence: " + source);
+    }
+
+    string format = opts.outputFormat;
+    if (format.empty()) {
+        format = output.find('%') != string::npos ? resolveOutputFormat(output, opts) : "png";
+        if (format.empty()) {
+            throw runtime_error("Unsupported output format for sequence: " + output);
+        }
+    }
+    bool rawStream = (format == "bgra" || format == "alpha") && output.find('%') == string::npos;
+    bool toStdout = rawStream && output == "-";
+    if (output == "-" && !rawStream) {
+        throw runtime_error("Sequences can only be written to stdout as -f bgra or -f alpha");
+    }
+    bool showProgress = !toStdout;
+
+    ofstream rawFile;
+    ostream* rawOut = nullptr;
+    if (toStdout) {
+        #ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+        #endif
+        rawOut = &cout;
+    } else if (rawStream) {
+        rawFile.open(output, ios::binary);
+        if (!rawFile) {
+            throw runtime_error("Could not open output: " + output);
+        }
+        rawOut = &rawFile;
+    } else if (output.find('%') == string::npos) {
+        utils::fs::createDirectories(output);
+    }
+
+    if (opts.verbose && showProgress) {
+        printProcessingOptions(opts);
+        double fps = capture.get(CAP_PROP_FPS);
+        if (fps > 0) cout << "Sequence frame rate: " << fps << " fps" << endl;
+    }
+
+    ProcessingOptions frameOpts = opts;
+    frameOpts.outputFormat = format;
+
+    TemporalGrabCut tracker;
+    Mat lastMask, lastInferred;
+    int frames = 0, keyframes = 0, tracked = 0, reused = 0;
+    RunSummary summary;
+    int64 start = getTickCount();
+    Size streamSize;
+
+    Mat frame;
+    while (true) {
+        Metrics frameMetrics;
+        Metrics* metrics = metricsOut ? &frameMetrics : nullptr;
+        int64 frameStart = getTickCount();
+
+        StageTimer decodeTimer(metrics, "decode");
+        if (!capture.read(frame) || frame.empty()) break;
+        decodeTimer.stop();
+        if (frame.channels() == 1) cvtColor(frame, frame, COLOR_GRAY2BGR);
+        if (frame.channels() == 4) cvtColor(frame, frame, COLOR_BGRA2BGR);
+        int index = frames++;
+        recordImageMetrics(metrics, frame.size(), opts);
+        if (metrics) metrics->set("frame", index);
+
+        string kind;
+        string path = rawStream ? output : sequenceFramePath(output, outputExtension(format), index);
+        string error;
+        bool overBudget = false;
+        try {
+            // Budgets and the deadline apply to each frame. Frames over a
+            // budget with over-budget=downscale are segmented (and tracked)
+            // at a reduced size, and their masks scaled back up.
+            ProcessingOptions budgetOpts = opts;
+            budgetOpts.deadlineTick = 0;
+            startDeadline(budgetOpts);
+            double scale = admitImage(frame.size(), budgetOpts);
+            Mat segmented = frame;
+            if (scale < 1.0) {
+                resize(frame, segmented, Size(), scale, scale, INTER_AREA);
+                if (metrics) metrics->set("budget_scale", scale);
+            }
+
+            Mat thumbnail = frameThumbnail(segmented);
+            Mat mask;
+            if (opts.useML) {
+                if (!lastMask.empty() && lastMask.size() == frame.size() &&
+                    frameDifference(thumbnail, lastInferred) < opts.mlSkipThreshold) {
+                    mask = lastMask;
+                    kind = "reused";
+                    reused++;
+                } else {
+                    mask = segmentImage(segmented, budgetOpts, model, false, metrics);
+                    lastInferred = thumbnail;
+                    kind = "inferred";
+                    keyframes++;
+                }
+            } else {
+                bool keyframe = false;
+                int used = 0;
+                mask = segmentFrameTracked(segmented, thumbnail, tracker, budgetOpts, keyframe, used, metrics);
+                checkDeadline(budgetOpts, "before refinement");
+                refineSegmentation(segmented, mask, budgetOpts, metrics);
+                kind = (keyframe ? "keyframe, " : "tracked, ") + to_string(used) + " iterations";
+                (keyframe ? keyframes : tracked)++;
+            }
+            if (mask.size() != frame.size()) {
+                StageTimer upscaleTimer(metrics, "mask_upscale");
+                mask = upscaleMask(mask, frame, frame.size());
+            }
+            if (opts.useML) lastMask = mask;
+            checkDeadline(budgetOpts, "before encoding");
+
+            if (rawOut) {
+                // Every frame of a raw stream must have the same size
+                if (streamSize.area() == 0) streamSize = frame.size();
+                if (frame.size() != streamSize) {
+                    throw runtime_error("Frame size changed mid-stream");
+                }
+                writeOutput(*rawOut, frame, mask, format, opts.compression, metrics);
+                if (!*rawOut) throw runtime_error("Could not write output: " + output);
+            } else {
+                saveImage(path, frame, mask, frameOpts, metrics);
+            }
+        } catch (const exception& e) {
+            error = e.what();
+            overBudget = isOverBudget(e);
+            // A frame stopped mid-GrabCut leaves half-updated state; start over
+            tracker = TemporalGrabCut();
+        }
+
+        double ms = (getTickCount() - frameStart) * 1000.0 / getTickFrequency();
+        if (error.empty()) {
+            if (showProgress) {
+                cout << "Frame " << index << ": " << ms << " ms (" << kind << ")";
+                if (!rawStream) cout << " → " << path;
+                cout << endl;
+            }
+        } else {
+            cerr << "❌ Frame " << index << ": " << error << endl;
+            summary.failed++;
+            if (overBudget) summary.overBudget++;
+        }
+        if (metrics) {
+            if (!kind.empty()) metrics->set("segmentation", kind.substr(0, kind.find(',')));
+            writeMetrics(*metricsOut, frameMetrics, source, path, error);
+        }
+    }
+    if (rawOut) rawOut->flush();
+
+    if (frames == 0) {
+        throw runtime_error("No frames could be read from: " + source);
+    }
+
+    if (showProgress) {
+        double seconds = (getTickCount() - start) / getTickFrequency();
+        cout << "Sequence complete: " << frames << " frames (" << keyframes
+             << (opts.useML ? " inferred, " : " keyframes, ")
+             << (opts.useML ? reused : tracked) << (opts.useML ? " reused" : " tracked") << "), "
+             << summary.failed << " failed in " << seconds << "s (" << (seconds > 0 ? frames / seconds : 0) << " fps)";
+        if (rawStream) cout << " → " << output << " (" << streamSize.width << "x" << streamSize.height << ")";
+        cout << endl;
+    }
+    return summary;
+}
+
+#ifndef _WIN32
+// Server protocol limits, so a bad client cannot make us allocate unbounded memory
+const uint32_t kMaxOptionsBytes = 64 * 1024;
+const uint32_t kMaxImageBytes = 256 * 1024 * 1024;
+const int kSocketTimeoutSeconds = 30;
+
+// Response status codes
+const uint32_t kStatusOk = 0;
+const uint32_t kStatusError = 1;
+
+// SIGINT and SIGTERM, which stop the server
+sigset_t stopSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    return signals;
+}
+
+void blockStopSignals() {
+    sigset_t signals = stopSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+// Read exactly len bytes from a socket
+void readFull(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw runtime_error("Connection closed while reading request");
+        p += n;
+        len -= n;
+    }
+}
+
+// Write exactly len bytes to a socket
+void writeFull(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw runtime_error("Connection closed while writing response");
+        p += n;
+        len -= n;
+    }
+}
+
+// Read a length-prefixed frame (u32 big-endian length, then payload)
+vector<uchar> readFrame(int fd, uint32_t maxLen) {
+    uint32_t len_be;
+    readFull(fd, &len_be, sizeof(len_be));
+    uint32_t len = ntohl(len_be);
+    if (len > maxLen) {
+        throw runtime_error("Frame of " + to_string(len) + " bytes exceeds limit of " + to_string(maxLen));
+    }
+    vector<uchar> frame(len);
+    if (len > 0) readFull(fd, frame.data(), len);
+    return frame;
+}
+
+// Read the next frame, or return false on a clean end of input before it
+bool readFrameIfAny(int fd, uint32_t maxLen, vector<uchar>& frame) {
+    uint8_t first;
+    ssize_t n;
+    do {
+        n = read(fd, &first, 1);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) return false;
+    if (n < 0) throw runtime_error(string("Read failed: ") + strerror(errno));
+
+    uint8_t rest[3];
+    readFull(fd, rest, sizeof(rest));
+    uint32_t len = (uint32_t(first) << 24) | (uint32_t(rest[0]) << 16) | (uint32_t(rest[1]) << 8) | rest[2];
+    if (len > maxLen) {
+        throw runtime_error("Frame of " + to_string(len) + " bytes exceeds limit of " + to_string(maxLen));
+    }
+    frame.assign(len, 0);
+    if (len > 0) readFull(fd, frame.data(), len);
+    return true;
+}
+
+// Write a response: u32 status, u32 payload length, payload
+void writeResponse(int fd, uint32_t status, const void* data, size_t len) {
+    uint32_t header[2] = {htonl(status), htonl(static_cast<uint32_t>(len))};
+    writeFull(fd, header, sizeof(header));
+    if (len > 0) writeFull(fd, data, len);
+}
+
+// Bounded producer/consumer queue. push() blocks while the queue is full, so
+// a fast producer waits for its consumers instead of piling up work in
+// memory: the accept loop lets clients back up in the listen backlog, and the
+// stream pipeline keeps only a few frames in flight.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // Returns false, without queuing the item, if the queue is closed
+    bool push(T item) {
+        unique_lock<mutex> lock(mtx);
+        notFull.wait(lock, [this] { return closed || pending.size() < capacity; });
+        if (closed) return false;
+        pending.push_back(move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T& item) {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [this] { return closed || !pending.empty(); });
+        if (pending.empty()) return false;
+        item = move(pending.front());
+        pending.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Consumers still drain what is queued; a blocked push() gives up
+    void close() {
+        lock_guard<mutex> lock(mtx);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed = false;
+    deque<T> pending;
+    mutex mtx;
+    condition_variable notEmpty;
+    condition_variable notFull;
+};
+
+// Apply a request's options frame on top of the base options: "key=value"
+// lines using the setOption names, plus output=<format> (default png). The
+// budgets come from the base options only, and the deadline starts here.
+void parseRequestOptions(const vector<uchar>& frame, const ProcessingOptions& baseOpts, const MLModel* model,
+                         ProcessingOptions& opts, string& format) {
+    opts = baseOpts;
+    format = "png";
+
+    istringstream options(string(frame.begin(), frame.end()));
+    string line;
+    while (getline(options, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        size_t eq = line.find('=');
+        if (eq == string::npos) {
+            throw invalid_argument("Malformed option line: " + line);
+        }
+        string key = line.substr(0, eq);
+        string value = line.substr(eq + 1);
+        if (key == "output") {
+            if (!isOutputFormat(value)) {
+                throw invalid_argument("Invalid output. Use: png, webp, qoi, mask, bgra, or alpha");
+            }
+            format = value;
+        } else {
+            setOption(opts, key, value);
+        }
+    }
+    applyPreset(opts);
+
+    if (opts.useML && model == nullptr) {
+        throw runtime_error("ML mode requested but no model was loaded");
+    }
+    startDeadline(opts);
+}
+
+// Decode a request's image frame, after checking its header against the budgets
+Mat decodeRequestImage(const vector<uchar>& frame, const ProcessingOptions& opts) {
+    if (frame.empty()) {
+        throw runtime_error("No image data in request");
+    }
+    Mat image = decodeAdmittedImage(frame.data(), frame.size(), opts);
+    if (image.empty()) {
+        throw runtime_error("Could not decode image from request");
+    }
+    return image;
+}
+
+// Serve one request on an accepted connection, then close it.
+//
+// Request:  u32 options length, options text, u32 image length, image bytes
+// Response: u32 status (0 = ok, 1 = error), u32 payload length, payload
+//
+// Options are "key=value" lines using the setOption names (quality, iterations,
+// margin, edge-mode, adaptive, convergence, mode, compression) plus
+// output=<format>. The payload is the encoded result or the error message.
+void handleConnection(int fd, const ProcessingOptions& baseOpts, MLModel* model) {
+    try {
+        vector<uchar> optionsFrame = readFrame(fd, kMaxOptionsBytes);
+        vector<uchar> imageFrame = readFrame(fd, kMaxImageBytes);
+
+        try {
+            ProcessingOptions opts;
+            string format;
+            parseRequestOptions(optionsFrame, baseOpts, model, opts, format);
+            Mat image = decodeRequestImage(imageFrame, opts);
+
+            int64 start = getTickCount();
+            Mat mask = computeMask(image, opts, model, false);
+            vector<uchar> encoded;
+            encodeOutput(image, mask, format, opts.compression, encoded);
+
+            if (opts.verbose) {
+                double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+                cerr << "Served " << image.cols << "x" << image.rows << " (" << (opts.useML ? "ML" : "GrabCut")
+                     << ", " << format << ") in " << ms << " ms" << endl;
+            }
+
+            writeResponse(fd, kStatusOk, encoded.data(), encoded.size());
+        } catch (const exception& e) {
+            string message = e.what();
+            writeResponse(fd, kStatusError, message.data(), message.size());
+        }
+    } catch (const exception& e) {
+        // Connection-level failure: the client is gone or sent a broken frame
+        if (baseOpts.verbose) {
+            cerr << "Connection error: " << e.what() << endl;
+        }
+    }
+    close(fd);
+}
+
+// Listen on a Unix domain socket and serve requests from a fixed-size worker
+// pool that shares the warm model. Runs until SIGINT or SIGTERM, which should
+// be blocked with blockStopSignals() before the model is loaded, so that no
+// ONNX Runtime, OpenCV or worker thread can take them.
+int runServer(const string& socketPath, const ProcessingOptions& baseOpts, MLModel* model,
+              int workers, int queueSize) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        cerr << "Error: Socket path is too long: " << socketPath << endl;
+        return 1;
+    }
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    // Remove a stale socket left by a previous run, but never a regular file
+    struct stat st;
+    if (stat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socketPath.c_str());
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        cerr << "Error: Could not create socket: " << strerror(errno) << endl;
+        return 1;
+    }
+    if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listenFd, SOMAXCONN) < 0) {
+        cerr << "Error: Could not listen on " << socketPath << ": " << strerror(errno) << endl;
+        close(listenFd);
+        return 1;
+    }
+
+    // A client hanging up mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // The listen socket is polled, so it must not block in accept() when a
+    // client goes away between poll() and accept()
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+    int stopPipe[2];
+    if (pipe(stopPipe) < 0) {
+        cerr << "Error: Could not create pipe: " << strerror(errno) << endl;
+        close(listenFd);
+        return 1;
+    }
+
+    if (workers <= 0) workers = max(1u, thread::hardware_concurrency());
+    if (queueSize <= 0) queueSize = workers * 2;
+
+    BoundedQueue<int> queue(queueSize);
+
+    // SIGINT/SIGTERM are blocked in every thread and taken here with sigwait.
+    // Closing the queue wakes an accept loop blocked in push(), and the pipe
+    // wakes one blocked in poll().
+    blockStopSignals();
+    thread signalWatcher([&queue, &stopPipe] {
+        sigset_t signals = stopSignals();
+        int signalNumber;
+        sigwait(&signals, &signalNumber);
+        queue.close();
+        char byte = 0;
+        ssize_t written = write(stopPipe[1], &byte, 1);
+        (void)written;
+    });
+
+    vector<thread> pool;
+    for (int i = 0; i < workers; i++) {
+        pool.emplace_back([&queue, &baseOpts, model] {
+            int fd;
+            while (queue.pop(fd)) {
+                handleConnection(fd, baseOpts, model);
+            }
+        });
+    }
+
+    cout << "Listening on " << socketPath << " (" << workers << " workers, queue " << queueSize << ")" << endl;
+
+    pollfd watched[2] = {{listenFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+    bool stopping = false;
+    while (!stopping) {
+        if (poll(watched, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error: poll failed: " << strerror(errno) << endl;
+            break;
+        }
+        if (watched[1].revents != 0) {
+            stopping = true;
+            break;
+        }
+        if (watched[0].revents == 0) continue;
+
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+            cerr << "Error: accept failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        // Connections are served with blocking I/O (some systems let them
+        // inherit O_NONBLOCK from the listen socket)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+        // Drop clients that stall mid-frame instead of pinning a worker
+        timeval timeout = {kSocketTimeoutSeconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if (!queue.push(fd)) {
+            close(fd);
+            stopping = true;
+        }
+    }
+
+    // Finish queued requests, then shut down. If the loop ended on an error,
+    // wake the watcher, which is still waiting for a signal.
+    close(listenFd);
+    queue.close();
+    if (!stopping) pthread_kill(signalWatcher.native_handle(), SIGTERM);
+    signalWatcher.join();
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    for (thread& worker : pool) {
+        worker.join();
+    }
+    unlink(socketPath.c_str());
+    cout << "Server stopped" << endl;
+    return 0;
+}
+
+// One frame moving through the stream pipeline
+struct StreamJob {
+    ProcessingOptions opts;
+    string format;
+    Mat image;
+    Mat mask;
+    string error;  // Set once a stage fails; later stages pass it through
+};
+
+// Stream mode: framed requests on stdin, framed responses on stdout, with the
+// same framing and options as server mode. Decoding, segmentation and
+// encoding run on their own threads, linked by small bounded queues, so frame
+// N+1 decodes while frame N is segmented and frame N-1 is encoded. Responses
+// come back in request order. A bad frame gets an error response and the
+// stream continues; only broken framing ends it, or a failed write to stdout,
+// which stops all three stages. Returns the exit code.
+int runStream(const ProcessingOptions& baseOpts, MLModel* model) {
+    // A consumer that goes away shows up as a write error, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    // The writer sets outputFailed and writes to the pipe, which wakes a
+    // reader waiting in poll() for the next frame
+    int stopPipe[2];
+    if (pipe(stopPipe) < 0) {
+        cerr << "Error: Could not create pipe: " << strerror(errno) << endl;
+        return 1;
+    }
+    atomic<bool> outputFailed(false);
+
+    BoundedQueue<StreamJob> decoded(2);
+    BoundedQueue<StreamJob> segmented(2);
+    string inputError;
+
+    thread reader([&] {
+        try {
+            vector<uchar> optionsFrame, imageFrame;
+            pollfd watched[2] = {{STDIN_FILENO, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+            while (!outputFailed) {
+                if (poll(watched, 2, -1) < 0) {
+                    if (errno == EINTR) continue;
+                    throw runtime_error(string("poll failed: ") + strerror(errno));
+                }
+                if (watched[1].revents != 0) break;
+                if (!readFrameIfAny(STDIN_FILENO, kMaxOptionsBytes, optionsFrame)) break;
+                imageFrame = readFrame(STDIN_FILENO, kMaxImageBytes);
+                StreamJob job;
+                try {
+                    parseRequestOptions(optionsFrame, baseOpts, model, job.opts, job.format);
+                    job.image = decodeRequestImage(imageFrame, job.opts);
+                } catch (const exception& e) {
+                    job.error = e.what();
+                }
+                if (!decoded.push(move(job))) break;
+            }
+        } catch (const exception& e) {
+            inputError = e.what();
+        }
+        decoded.close();
+    });
+
+    int64 served = 0;
+    int64 failed = 0;
+    string outputError;
+    thread writer([&] {
+        StreamJob job;
+        vector<uchar> payload;  // Reused, so encoding stops allocating once it has grown
+        while (segmented.pop(job)) {
+            int64 start = getTickCount();
+            uint32_t status = kStatusOk;
+            payload.clear();
+            if (job.error.empty()) {
+                try {
+                    encodeOutput(job.image, job.mask, job.format, job.opts.compression, payload);
+                } catch (const exception& e) {
+                    job.error = e.what();
+                }
+            }
+            if (!job.error.empty()) {
+                status = kStatusError;
+                payload.assign(job.error.begin(), job.error.end());
+                failed++;
+            }
+
+            try {
+                writeResponse(STDOUT_FILENO, status, payload.data(), payload.size());
+                served++;
+            } catch (const exception& e) {
+                // Nobody is reading the results: stop decoding and segmenting
+                // the rest of stdin. Closing the queues wakes stages blocked
+                // on them, the pipe wakes the reader.
+                outputError = e.what();
+                outputFailed = true;
+                char byte = 0;
+                ssize_t written = write(stopPipe[1], &byte, 1);
+                (void)written;
+                decoded.close();
+                segmented.close();
+                break;
+            }
+
+            if (baseOpts.verbose && job.error.empty()) {
+                double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+                cerr << "Encoded " << job.image.cols << "x" << job.image.rows << " (" << job.format << ") in "
+                     << ms << " ms" << endl;
+            }
+        }
+    });
+
+    StreamJob job;
+    while (decoded.pop(job) && !outputFailed) {
+        if (job.error.empty()) {
+            try {
+                int64 start = getTickCount();
+                job.mask = computeMask(job.image, job.opts, model, false);
+                if (baseOpts.verbose) {
+                    double ms = (getTickCount() - start) * 1000.0 / getTickFrequency();
+                    cerr << "Segmented " << job.image.cols << "x" << job.image.rows << " ("
+                         << (job.opts.useML ? "ML" : "GrabCut") << ") in " << ms << " ms" << endl;
+                }
+            } catch (const exception& e) {
+                job.error = e.what();
+            }
+        }
+        if (!segmented.push(move(job))) break;
+    }
+    segmented.close();
+
+    reader.join();
+    writer.join();
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+
+    if (baseOpts.verbose) {
+        cerr << "Stream complete: " << served << " frames, " << failed << " failed" << endl;
+    }
+    if (!inputError.empty()) {
+        cerr << "Error: " << inputError << endl;
+        return 1;
+    }
+    if (!outputError.empty()) {
+        cerr << "Error: " << outputError << endl;
+        return 1;
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,145 @@
+#ifndef BG_REMOVER_PIPELINE_HPP
+#define BG_REMOVER_PIPELINE_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Internal C++ interface to the pipeline in pipeline.cpp, shared by the
+// command-line tool and the C library (bgremover.h). Not a stable API.
+
+class MaskCache;
+class Metrics;
+
+// Loaded ONNX model with its session and per-thread buffers. An empty
+// placeholder in builds without ML support.
+struct MLModel;
+
+// Processing options structure
+struct ProcessingOptions {
+    std::string quality = "balanced";
+    int iterations = 8;
+    int margin = -1;  // -1 = auto
+    std::string edgeMode = "guided";  // blur, bilateral, guided, fast-guided
+    bool verbose = false;
+    double kernelScale = 1.0;
+    bool useML = false;
+    std::string modelPath = "";
+    std::string modelNorm = "raw";    // Input normalization preset (see preprocess.hpp)
+    int intraOpThreads = 1;      // ORT threads within one operator
+    int interOpThreads = 0;      // ORT threads across operators (0 = ORT default)
+    bool parallelExecution = false;  // ORT_PARALLEL instead of ORT_SEQUENTIAL
+    int mlBatchSize = 1;         // Images stacked per inference for dynamic-batch models
+    std::string modelVariant = "";    // "int8" or "fp16" loads <model>.<variant>.onnx instead
+    bool modelCache = true;      // Cache the optimized graph next to the model
+    bool warmup = false;         // Run one dummy inference right after loading
+    bool coarseToFine = false;   // GrabCut at reduced size, refine boundary at full size
+    int coarseMaxDim = 1024;     // Longest side of the coarse GrabCut pass
+    int refineIterations = 2;    // Full-resolution iterations in the boundary band
+    bool adaptive = false;       // Stop GrabCut early once the mask stops changing
+    double convergence = 0.001;  // Fraction of changed pixels that counts as converged
+    bool tiled = false;          // Always use the strip pipeline for single images
+    int maxMemoryMB = 0;         // Working memory budget; larger images are tiled (0 = none)
+    std::string outputFormat = "";    // png, webp, qoi, mask, bgra, alpha ("" = from the output extension)
+    int compression = 9;         // PNG deflate level (0-9)
+    int temporalIterations = 2;  // GrabCut iterations on tracked sequence frames
+    double sceneCut = 0.2;       // Frame difference that restarts GrabCut in a sequence
+    double mlSkipThreshold = 0.005;  // Frame difference below which ML reuses the last mask
+    std::string mlUpsample = "linear";  // ML mask to image size: linear or guided (edge-aware)
+    // Per-image budgets for untrusted inputs (0 = none). See admitImage.
+    int maxPixels = 0;           // Pixels (width x height)
+    int maxDecodedMB = 0;        // Decoded BGR image; checked from the header before decoding
+    int memoryCeilingMB = 0;     // Estimated peak memory for one image
+    int deadlineMs = 0;          // Wall time, checked between stages and GrabCut iterations
+    std::string overBudget = "reject";  // reject, or downscale: segment a smaller copy to fit
+    int64_t deadlineTick = 0;    // getTickCount() at which the deadline passes; set by startDeadline
+};
+
+// An image rejected by one of the budgets in ProcessingOptions
+struct BudgetExceeded : std::runtime_error {
+    explicit BudgetExceeded(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Exit code of the command-line tool when its image is over a budget
+const int kExitBudgetExceeded = 3;
+
+// Outcome of a batch or sequence run
+struct RunSummary {
+    int failed = 0;      // images or frames that failed
+    int overBudget = 0;  // of those, rejected by a budget or the deadline
+};
+
+// One input/output pair in a batch run
+struct BatchItem {
+    std::string input;
+    std::string output;
+};
+
+// Options
+void applyPreset(ProcessingOptions& opts);
+int parseIntOption(const std::string& name, const std::string& value);
+double parseDoubleOption(const std::string& name, const std::string& value);
+void setOption(ProcessingOptions& opts, const std::string& name, const std::string& value);
+// Budgets are set by whoever runs the process, never by a server request.
+// Returns false if `name` isn't a budget.
+bool setBudgetOption(ProcessingOptions& opts, const std::string& name, const std::string& value);
+bool isOutputFormat(const std::string& format);
+std::string outputExtension(const std::string& format);
+
+// Budgets. admitImage returns the fraction of its size an image can be
+// segmented at (1 when it fits) or throws BudgetExceeded. checkEncodedImage
+// does the same from the image header before decoding, where it can.
+// decodeAdmittedImage checks the header, then decodes to upright BGR the way
+// file inputs are decoded (EXIF orientation included); it returns an empty
+// Mat if the bytes can't be decoded.
+double admitImage(const cv::Size& size, const ProcessingOptions& opts);
+void checkEncodedImage(const void* data, size_t size, const ProcessingOptions& opts);
+cv::Mat decodeAdmittedImage(const void* data, size_t size, const ProcessingOptions& opts);
+void startDeadline(ProcessingOptions& opts);
+void checkDeadline(const ProcessingOptions& opts, const std::string& stage);
+bool isOverBudget(const std::exception& e);
+
+// ML models (only defined in builds with WITH_ML)
+std::shared_ptr<MLModel> loadModel(const ProcessingOptions& opts, bool verbose);
+void warmupModel(MLModel& model, bool verbose);
+// Run every thread on one set of inference buffers, for a model that is never
+// used by two threads at once (a C API context). By default each thread that
+// calls in gets buffers of its own, kept until the model is destroyed.
+void shareModelScratch(MLModel& model);
+
+// In-memory processing
+cv::Mat computeMask(const cv::Mat& image, const ProcessingOptions& opts, MLModel* model, bool showVerbose,
+                    Metrics* metrics = nullptr);
+void encodeOutput(const cv::Mat& image, const cv::Mat& mask, const std::string& format, int compression,
+                  std::vector<uchar>& encoded);
+
+// Whole runs over files
+void removeBackground(const std::string& inputPath, const std::string& outputPath, const ProcessingOptions& opts,
+                      MLModel* model, Metrics* metrics = nullptr, MaskCache* cache = nullptr);
+std::vector<BatchItem> collectBatch(const std::string& source, const std::string& outputDir,
+                                    const std::string& extension);
+RunSummary runBatch(const std::vector<BatchItem>& items, const ProcessingOptions& opts, MLModel* model,
+                    std::ostream* metricsOut = nullptr, MaskCache* cache = nullptr);
+RunSummary runBatchPipelined(const std::vector<BatchItem>& items, const ProcessingOptions& opts, MLModel* model,
+                             int jobs, std::ostream* metricsOut = nullptr, MaskCache* cache = nullptr);
+RunSummary runSequence(const std::string& source, const std::string& output, const ProcessingOptions& opts,
+                       MLModel* model, std::ostream* metricsOut = nullptr);
+#ifndef _WIN32
+// Block SIGINT and SIGTERM in the calling thread and the threads it starts
+// afterwards; runServer waits for them on a thread of its own
+void blockStopSignals();
+int runServer(const std::string& socketPath, const ProcessingOptions& baseOpts, MLModel* model,
+              int workers, int queueSize);
+int runStream(const ProcessingOptions& baseOpts, MLModel* model);
+#endif
+
+// Metrics
+void writeMetrics(std::ostream& out, Metrics& metrics, const std::string& input, const std::string& output,
+                  const std::string& error);
+size_t peakRssBytes();
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef BG_REMOVER_PNG_WRITER_HPP
+#define BG_REMOVER_PNG_WRITER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Streaming 8-bit PNG encoder. Rows are filtered and deflated as they arrive,
+// so neither the whole raster nor the whole encoded file has to be held in
+// memory. Accepts BGRA (written as RGBA) or single-channel (grayscale) rows.
+// writeImage() encodes a whole image instead, compressing bands of rows on
+// several threads.
+class PngStreamWriter {
+public:
+    PngStreamWriter(std::ostream& out, int width, int height, int channels, int level)
+        : out(out), width(width), height(height), channels(channels),
+          level(level), rowBytes(static_cast<size_t>(width) * channels),
+          previous(rowBytes, 0), filtered(5, std::vector<uchar>(rowBytes + 1)) {
+        if (channels != 1 && channels != 4) {
+            throw std::invalid_argument("PNG stream writer supports 1 or 4 channels");
+        }
+
+        memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, level, Z_DEFLATED, 15, 8, Z_FILTERED) != Z_OK) {
+            throw std::runtime_error("Could not initialize PNG compressor");
+        }
+
+        static const uchar signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+        uchar ihdr[13];
+        putU32(ihdr, width);
+        putU32(ihdr + 4, height);
+        ihdr[8] = 8;                          // bit depth
+        ihdr[9] = channels == 4 ? 6 : 0;      // RGBA or grayscale
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;   // deflate, adaptive filtering, no interlace
+        writeChunk("IHDR", ihdr, sizeof(ihdr));
+    }
+
+    ~PngStreamWriter() {
+        deflateEnd(&stream);
+    }
+
+    // Append rows (CV_8UC4 BGRA or CV_8UC1, `width` columns) to the image
+    void writeRows(const cv::Mat& rows) {
+        CV_Assert(rows.cols == width && rows.channels() == channels && rows.depth() == CV_8U);
+        if (rowsWritten + rows.rows > height) {
+            throw std::runtime_error("PNG stream writer received more rows than declared");
+        }
+
+        cv::Mat converted;
+        const cv::Mat* source = &rows;
+        if (channels == 4) {
+            cv::cvtColor(rows, converted, cv::COLOR_BGRA2RGBA);
+            source = &converted;
+        }
+
+        for (int y = 0; y < source->rows; y++) {
+            const std::vector<uchar>& line = filterRow(source->ptr<uchar>(y), previous.data(), rowBytes, channels, filtered);
+            deflateBytes(line.data(), line.size(), Z_NO_FLUSH);
+            memcpy(previous.data(), source->ptr<uchar>(y), rowBytes);
+        }
+        rowsWritten += rows.rows;
+    }
+
+    // Write the whole image (all `height` rows) at once. Large images are
+    // split into bands that are filtered and deflated in parallel as separate
+    // raw deflate streams. Every band but the last ends with a sync flush,
+    // which leaves it byte-aligned and unterminated, so the bands concatenate
+    // into one valid zlib stream (the technique pigz uses). Bands start with
+    // an empty dictionary, which costs a little ratio at each band edge.
+    void writeImage(const cv::Mat& image) {
+        CV_Assert(image.cols == width && image.rows == height && image.channels() == channels &&
+                  image.depth() == CV_8U && rowsWritten == 0);
+
+        size_t rawBytes = rowBytes * height;
+        int bands = static_cast<int>(std::min<size_t>(rawBytes / kBandBytes, 4 * cv::getNumThreads()));
+        bands = std::min(bands, height);
+        if (bands < 2) {
+            writeRows(image);
+            return;
+        }
+
+        cv::Mat converted;
+        const cv::Mat* source = &image;
+        if (channels == 4) {
+            cv::cvtColor(image, converted, cv::COLOR_BGRA2RGBA);
+            source = &converted;
+        }
+
+        std::vector<std::vector<uchar>> compressed(bands);
+        std::vector<uLong> checksums(bands);
+        std::vector<size_t> lengths(bands);
+        std::atomic<bool> failed(false);
+        cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+            std::vector<std::vector<uchar>> candidates(5, std::vector<uchar>(rowBytes + 1));
+            std::vector<uchar> zeros(rowBytes, 0);
+            for (int band = range.start; band < range.end; band++) {
+                int y0 = static_cast<int>(static_cast<int64_t>(height) * band / bands);
+                int y1 = static_cast<int>(static_cast<int64_t>(height) * (band + 1) / bands);
+
+                z_stream band_stream;
+                memset(&band_stream, 0, sizeof(band_stream));
+                if (deflateInit2(&band_stream, level, Z_DEFLATED, -15, 8, Z_FILTERED) != Z_OK) {
+                    failed = true;
+                    continue;
+                }
+                uLong checksum = adler32(0L, Z_NULL, 0);
+                for (int y = y0; y < y1; y++) {
+                    const uchar* up = y > 0 ? source->ptr<uchar>(y - 1) : zeros.data();
+                    const std::vector<uchar>& line = filterRow(source->ptr<uchar>(y), up, rowBytes, channels, candidates);
+                    checksum = adler32(checksum, line.data(), static_cast<uInt>(line.size()));
+                    int flush = y + 1 < y1 ? Z_NO_FLUSH : (band + 1 < bands ? Z_SYNC_FLUSH : Z_FINISH);
+                    if (!deflateInto(band_stream, line.data(), line.size(), flush, compressed[band])) {
+                        failed = true;
+                    }
+                }
+                deflateEnd(&band_stream);
+                checksums[band] = checksum;
+                lengths[band] = static_cast<size_t>(y1 - y0) * (rowBytes + 1);
+            }
+        });
+        if (failed) {
+            throw std::runtime_error("PNG compression failed");
+        }
+
+        // zlib header (deflate, 32K window, level hint) and the combined Adler-32 trailer
+        int levelHint = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        uchar header[2] = {0x78, static_cast<uchar>(levelHint << 6)};
+        header[1] += (31 - ((header[0] << 8) | header[1]) % 31) % 31;
+        appendIdat(header, sizeof(header));
+
+        uLong checksum = adler32(0L, Z_NULL, 0);
+        for (int band = 0; band < bands; band++) {
+            appendIdat(compressed[band].data(), compressed[band].size());
+            std::vector<uchar>().swap(compressed[band]);
+            checksum = adler32_combine(checksum, checksums[band], static_cast<z_off_t>(lengths[band]));
+        }
+        uchar trailer[4];
+        putU32(trailer, static_cast<uint32_t>(checksum));
+        appendIdat(trailer, sizeof(trailer));
+
+        rowsWritten = height;
+        streamFinished = true;
+    }
+
+    // Flush the compressor and write the trailing chunks
+    void finish() {
+        if (rowsWritten != height) {
+            throw std::runtime_error("PNG stream writer finished after " + std::to_string(rowsWritten) +
+                                     " of " + std::to_string(height) + " rows");
+        }
+        if (!streamFinished) {
+            deflateBytes(nullptr, 0, Z_FINISH);
+        }
+        flushIdat();
+        writeChunk("IEND", nullptr, 0);
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Could not write PNG output");
+        }
+    }
+
+private:
+    static const size_t kIdatSize = 256 * 1024;
+    static const size_t kBandBytes = 1024 * 1024;  // Minimum raw bytes per parallel band
+
+    std::ostream& out;
+    int width;
+    int height;
+    int channels;
+    int level;
+    size_t rowBytes;
+    int rowsWritten = 0;
+    bool streamFinished = false;  // writeImage() produced the whole zlib stream
+    z_stream stream;
+    std::vector<uchar> previous;
+    std::vector<std::vector<uchar>> filtered;  // One candidate per PNG filter type
+    std::vector<uchar> idat;
+
+    static void putU32(uchar* p, uint32_t v) {
+        p[0] = v >> 24;
+        p[1] = (v >> 16) & 0xff;
+        p[2] = (v >> 8) & 0xff;
+        p[3] = v & 0xff;
+    }
+
+    void writeChunk(const char* type, const uchar* data, size_t len) {
+        uchar header[8];
+        putU32(header, static_cast<uint32_t>(len));
+        memcpy(header + 4, type, 4);
+        uLong crc = crc32(0, header + 4, 4);
+        if (len > 0) crc = crc32(crc, data, static_cast<uInt>(len));
+        uchar trailer[4];
+        putU32(trailer, static_cast<uint32_t>(crc));
+
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        if (len > 0) out.write(reinterpret_cast<const char*>(data), len);
+        out.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+    }
+
+    void flushIdat() {
+        if (!idat.empty()) {
+            writeChunk("IDAT", idat.data(), idat.size());
+            idat.clear();
+        }
+    }
+
+    // Append to the pending IDAT data, writing full chunks as they fill
+    void appendIdat(const uchar* data, size_t len) {
+        while (len > 0) {
+            size_t take = std::min(len, kIdatSize - idat.size());
+            idat.insert(idat.end(), data, data + take);
+            data += take;
+            len -= take;
+            if (idat.size() >= kIdatSize) flushIdat();
+        }
+    }
+
+    // Run deflate over `data` and append all output it produces. Returns false on error.
+    static bool deflateInto(z_stream& zs, const uchar* data, size_t len, int flush, std::vector<uchar>& output) {
+        uchar buffer[64 * 1024];
+        zs.next_in = const_cast<uchar*>(data);
+        zs.avail_in = static_cast<uInt>(len);
+        int status;
+        do {
+            zs.next_out = buffer;
+            zs.avail_out = sizeof(buffer);
+            status = deflate(&zs, flush);
+            if (status == Z_STREAM_ERROR) {
+                return false;
+            }
+            output.insert(output.end(), buffer, buffer + (sizeof(buffer) - zs.avail_out));
+        } while (zs.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+        return true;
+    }
+
+    void deflateBytes(const uchar* data, size_t len, int flush) {
+        if (!deflateInto(stream, data, len, flush, idat)) {
+            throw std::runtime_error("PNG compression failed");
+        }
+        if (idat.size() >= kIdatSize) flushIdat();
+    }
+
+    static uchar paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return static_cast<uchar>(a);
+        return static_cast<uchar>(pb <= pc ? b : c);
+    }
+
+    // Apply all five PNG filters and keep the one with the smallest sum of
+    // absolute values (the heuristic libpng uses). `up` is the previous row
+    // (zeros for the first), `candidates` is scratch with one line per filter.
+    static const std::vector<uchar>& filterRow(const uchar* row, const uchar* up, size_t rowBytes, size_t bpp,
+                                               std::vector<std::vector<uchar>>& candidates) {
+        size_t best = 0;
+        uint64_t bestScore = UINT64_MAX;
+
+        for (size_t type = 0; type < 5; type++) {
+            uchar* line = candidates[type].data();
+            line[0] = static_cast<uchar>(type);
+            uchar* dst = line + 1;
+
+            switch (type) {
+                case 0:  // None
+                    memcpy(dst, row, rowBytes);
+                    break;
+                case 1:  // Sub
+                    for (size_t i = 0; i < bpp; i++) dst[i] = row[i];
+                    for (size_t i = bpp; i < rowBytes; i++) dst[i] = row[i] - row[i - bpp];
+                    break;
+                case 2:  // Up
+                    for (size_t i = 0; i < rowBytes; i++) dst[i] = row[i] - up[i];
+                    break;
+                case 3:  // Average
+                    for (size_t i = 0; i < bpp; i++) dst[i] = row[i] - (up[i] >> 1);
+                    for (size_t i = bpp; i < rowBytes; i++) dst[i] = row[i] - ((row[i - bpp] + up[i]) >> 1);
+                    break;
+                default:  // Paeth
+                    for (size_t i = 0; i < bpp; i++) dst[i] = row[i] - up[i];
+                    for (size_t i = bpp; i < rowBytes; i++) dst[i] = row[i] - paeth(row[i - bpp], up[i], up[i - bpp]);
+                    break;
+            }
+
+            uint64_t score = 0;
+            for (size_t i = 0; i < rowBytes; i++) {
+                score += dst[i] < 128 ? dst[i] : 256 - dst[i];
+            }
+            if (score < bestScore) {
+                bestScore = score;
+                best = type;
+            }
+        }
+        return candidates[best];
+    }
+};
+
+#endif
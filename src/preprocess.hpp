@@ -0,0 +1,67 @@
+#ifndef BG_REMOVER_PREPROCESS_HPP
+#define BG_REMOVER_PREPROCESS_HPP
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+// Per-model input normalization: value = (pixel / 255 - mean) / std.
+// mean and std are given in the model's channel order.
+struct TensorNormalization {
+    bool rgb = false;  // Model expects RGB (OpenCV decodes to BGR)
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    float std[3] = {1.0f, 1.0f, 1.0f};
+};
+
+// Look up a named normalization preset. Returns false for unknown names.
+//   raw      - BGR scaled to [0,1] (the original behavior)
+//   imagenet - RGB with ImageNet mean/std (U2-Net)
+//   rmbg     - RGB with mean 0.5, std 1.0 (BRIA RMBG)
+inline bool normalizationPreset(const std::string& name, TensorNormalization& norm) {
+    norm = TensorNormalization();
+    if (name == "raw") {
+        return true;
+    } else if (name == "imagenet") {
+        norm.rgb = true;
+        norm.mean[0] = 0.485f; norm.mean[1] = 0.456f; norm.mean[2] = 0.406f;
+        norm.std[0] = 0.229f; norm.std[1] = 0.224f; norm.std[2] = 0.225f;
+        return true;
+    } else if (name == "rmbg") {
+        norm.rgb = true;
+        norm.mean[0] = norm.mean[1] = norm.mean[2] = 0.5f;
+        return true;
+    }
+    return false;
+}
+
+// Resize a BGR8 image to the model input size and write it as normalized planar
+// float (CHW) straight into the tensor buffer. The resize runs on 8-bit data.
+// The channel deinterleave and the fused scale/offset use OpenCV's vectorized
+// split and convertTo. convertTo writes into Mat headers over the tensor, so
+// there is no float staging image and no separate transpose pass. `resized`
+// and `planes` are caller-owned scratch, so repeated calls do not allocate.
+inline void fillTensorNCHW(const cv::Mat& bgr, cv::Size inputSize, const TensorNormalization& norm,
+                           float* tensor, cv::Mat& resized, std::vector<cv::Mat>& planes) {
+    cv::resize(bgr, resized, inputSize, 0, 0, cv::INTER_LINEAR);
+    cv::split(resized, planes);
+
+    size_t planeSize = static_cast<size_t>(inputSize.area());
+    for (int c = 0; c < 3; c++) {
+        int source = norm.rgb ? 2 - c : c;
+        cv::Mat plane(inputSize, CV_32F, tensor + c * planeSize);
+        double alpha = 1.0 / (255.0 * norm.std[c]);
+        double beta = -norm.mean[c] / norm.std[c];
+        planes[source].convertTo(plane, CV_32F, alpha, beta);
+    }
+}
+
+// Turn a [0,1] probability map (a Mat header over the output tensor, not a
+// copy) into an 8-bit mask at the original image size. Quantizing before the
+// upsample keeps the full-resolution pass on 8-bit data and avoids a
+// full-size float buffer. `small` is caller-owned scratch.
+inline void tensorToMask(const cv::Mat& prob, cv::Size size, cv::Mat& small, cv::Mat& mask) {
+    prob.convertTo(small, CV_8U, 255.0);
+    cv::resize(small, mask, size, 0, 0, cv::INTER_LINEAR);
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef BG_REMOVER_QOI_WRITER_HPP
+#define BG_REMOVER_QOI_WRITER_HPP
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Encode a BGRA8 image as QOI (https://qoiformat.org), written as RGBA.
+// QOI is lossless and encodes in a single pass over the pixels, typically
+// many times faster than PNG at a moderately larger size. The encoded file
+// is appended to `out`.
+inline void encodeQoi(const cv::Mat& bgra, std::vector<uchar>& out) {
+    CV_Assert(bgra.type() == CV_8UC4);
+
+    out.reserve(out.size() + 14 + bgra.total() * 2 + 8);
+
+    auto putU32 = [&out](uint32_t v) {
+        out.push_back(v >> 24);
+        out.push_back((v >> 16) & 0xff);
+        out.push_back((v >> 8) & 0xff);
+        out.push_back(v & 0xff);
+    };
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    putU32(bgra.cols);
+    putU32(bgra.rows);
+    out.push_back(4);  // RGBA
+    out.push_back(0);  // sRGB with linear alpha
+
+    uchar index[64][4];
+    memset(index, 0, sizeof(index));
+    uchar prev[4] = {0, 0, 0, 255};
+    int run = 0;
+
+    for (int y = 0; y < bgra.rows; y++) {
+        const uchar* row = bgra.ptr<uchar>(y);
+        for (int x = 0; x < bgra.cols; x++) {
+            const uchar* p = row + 4 * x;
+            uchar px[4] = {p[2], p[1], p[0], p[3]};
+
+            if (memcmp(px, prev, 4) == 0) {
+                run++;
+                if (run == 62) {
+                    out.push_back(0xc0 | (run - 1));  // QOI_OP_RUN
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+
+            int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+            if (memcmp(index[hash], px, 4) == 0) {
+                out.push_back(hash);  // QOI_OP_INDEX
+            } else {
+                memcpy(index[hash], px, 4);
+                if (px[3] == prev[3]) {
+                    int dr = static_cast<signed char>(px[0] - prev[0]);
+                    int dg = static_cast<signed char>(px[1] - prev[1]);
+                    int db = static_cast<signed char>(px[2] - prev[2]);
+                    int dr_dg = dr - dg;
+                    int db_dg = db - dg;
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                        out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));  // QOI_OP_DIFF
+                    } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                        out.push_back(0x80 | (dg + 32));  // QOI_OP_LUMA
+                        out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+                    } else {
+                        out.insert(out.end(), {0xfe, px[0], px[1], px[2]});  // QOI_OP_RGB
+                    }
+                } else {
+                    out.insert(out.end(), {0xff, px[0], px[1], px[2], px[3]});  // QOI_OP_RGBA
+                }
+            }
+            memcpy(prev, px, 4);
+        }
+    }
+    if (run > 0) {
+        out.push_back(0xc0 | (run - 1));
+    }
+
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+}
+
+inline std::vector<uchar> encodeQoi(const cv::Mat& bgra) {
+    std::vector<uchar> out;
+    encodeQoi(bgra, out);
+    return out;
+}
+
+#endif